@@ -0,0 +1,73 @@
+/*
+ * bench_fill.c
+ *
+ * Microbenchmark comparing the scalar, 64-bit word and (where available)
+ * NEON variants of the fill and copy kernels in led_kernels.h on one
+ * NUM_LEDS frame. It does not touch the LED matrix device.
+ *
+ * Usage: bench_fill [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "led_matrix.h"
+#include "led_kernels.h"
+
+#define DEFAULT_ITERATIONS 1000000
+
+static uint16_t dst[NUM_LEDS];
+static uint16_t src[NUM_LEDS];
+
+/* Keep the compiler from optimizing away stores to <p> */
+static inline void sink(void *p) {
+
+	__asm__ volatile("" : : "r"(p) : "memory");
+}
+
+static double now_ns() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define BENCH(name, stmt) do {						\
+	double t0 = now_ns();						\
+	for (long i = 0; i < iterations; i++) {				\
+		stmt;							\
+		sink(dst);						\
+	}								\
+	printf("%-12s %8.2f ns/frame\n", name,				\
+	       (now_ns() - t0) / iterations);				\
+} while (0)
+
+int main(int argc, char *argv[]) {
+
+	long iterations = DEFAULT_ITERATIONS;
+	if (argc > 1) {
+		iterations = atol(argv[1]);
+	}
+	if (iterations <= 0) {
+		printf("Usage: %s [iterations]\n", argv[0]);
+		return -1;
+	}
+	for (int i = 0; i < NUM_LEDS; i++) {
+		src[i] = i * 0x0421;
+	}
+
+	BENCH("fill_scalar", fill_pixels_scalar(dst, (uint16_t)i, NUM_LEDS));
+	BENCH("fill_words", fill_pixels_words(dst, (uint16_t)i, NUM_LEDS));
+#ifdef LED_KERNELS_HAVE_NEON
+	BENCH("fill_neon", fill_pixels_neon(dst, (uint16_t)i, NUM_LEDS));
+#endif
+	BENCH("copy_scalar", copy_pixels_scalar(dst, src, NUM_LEDS); sink(src));
+	BENCH("copy_words", copy_pixels_words(dst, src, NUM_LEDS); sink(src));
+#ifdef LED_KERNELS_HAVE_NEON
+	BENCH("copy_neon", copy_pixels_neon(dst, src, NUM_LEDS); sink(src));
+#endif
+
+	return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * bench_led_matrix.c
+ *
+ * Benchmark for the functions in led_matrix.h. Every function is timed
+ * in samples of BATCH_SIZE calls, and the mean, median (p50) and 99th
+ * percentile (p99) cost per call is written to stdout as CSV.
+ *
+ * By default everything runs against the memory backend, so the numbers
+ * measure the library itself. With -d the real LED matrix device is used.
+ *
+ * Usage: bench_led_matrix [-d] [-n samples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "led_matrix.h"
+
+#define DEFAULT_SAMPLES 10000
+#define BATCH_SIZE 32
+#define OPEN_SAMPLES 100
+#define BATCH_OPS 24
+
+static uint16_t image[NUM_LEDS];
+static struct led_op ops[BATCH_OPS];
+static int64_t *samples;
+static enum led_backend backend = LED_BACKEND_MEMORY;
+static const char *backend_name = "memory";
+
+static int64_t now_ns() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_int64(const void *a, const void *b) {
+
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Sort <n> samples of <batch> calls each and print one CSV line */
+static void report(const char *function, int n, int batch) {
+
+	double total = 0;
+	for (int i = 0; i < n; i++) {
+		total += samples[i];
+	}
+	qsort(samples, n, sizeof(samples[0]), compare_int64);
+	printf("%s,%s,%d,%.1f,%.1f,%.1f\n", backend_name, function, n * batch,
+	       total / n / batch, (double)samples[n / 2] / batch,
+	       (double)samples[(int)(n * 0.99)] / batch);
+}
+
+#define BENCH(function, n, stmt) do {					\
+	for (int s = 0; s < (n); s++) {					\
+		int64_t t0 = now_ns();					\
+		for (int b = 0; b < BATCH_SIZE; b++) {			\
+			stmt;						\
+		}							\
+		samples[s] = now_ns() - t0;				\
+	}								\
+	report(function, (n), BATCH_SIZE);				\
+} while (0)
+
+static void bench_open_close(int n) {
+
+	int64_t *close_samples = malloc(n * sizeof(int64_t));
+	if (close_samples == NULL) {
+		perror("Error on call to malloc()");
+		return;
+	}
+	for (int s = 0; s < n; s++) {
+		int64_t t0 = now_ns();
+		if (open_led_matrix_backend(backend, NULL) == -1) {
+			free(close_samples);
+			return;
+		}
+		int64_t t1 = now_ns();
+		close_led_matrix();
+		samples[s] = t1 - t0;
+		close_samples[s] = now_ns() - t1;
+	}
+	report("open_led_matrix", n, 1);
+	memcpy(samples, close_samples, n * sizeof(int64_t));
+	report("close_led_matrix", n, 1);
+	free(close_samples);
+}
+
+int main(int argc, char *argv[]) {
+
+	int n = DEFAULT_SAMPLES;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "dn:")) != -1) {
+		switch (opt) {
+		case 'd':
+			backend = LED_BACKEND_DEVICE;
+			backend_name = "device";
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-d] [-n samples]\n", argv[0]);
+			return -1;
+		}
+	}
+	if (n < 1) {
+		n = 1;
+	}
+	samples = malloc((n > OPEN_SAMPLES ? n : OPEN_SAMPLES) *
+			 sizeof(int64_t));
+	if (samples == NULL) {
+		perror("Error on call to malloc()");
+		return -1;
+	}
+	for (int i = 0; i < NUM_LEDS; i++) {
+		image[i] = i * 0x0421;
+	}
+	/* A sparse update, scattered over the frame, with some repeats */
+	for (int i = 0; i < BATCH_OPS; i++) {
+		ops[i].index = (i * 37) % 48;
+		ops[i].color = i;
+	}
+
+	printf("backend,function,calls,ns_per_op,p50_ns,p99_ns\n");
+	bench_open_close(OPEN_SAMPLES);
+	if (open_led_matrix_backend(backend, NULL) == -1) {
+		printf("Failed to initialize LED matrix\n");
+		return -1;
+	}
+
+	BENCH("set_led", n, set_led(b % ROW_SIZE, s % COL_SIZE, b));
+	BENCH("set_led_unchecked", n,
+	      set_led_unchecked(b % ROW_SIZE, s % COL_SIZE, b));
+	BENCH("set_leds_batch", n, ops[b % BATCH_OPS].color = s;
+	      set_leds_batch(ops, BATCH_OPS));
+	BENCH("set_leds_batch_sorted", n, ops[b % BATCH_OPS].color = s;
+	      set_leds_batch_sorted(ops, BATCH_OPS));
+	BENCH("set_leds_image", n, image[0] = b; set_leds_image(image));
+	BENCH("set_leds_single_color", n, set_leds_single_color(b));
+	BENCH("clear_leds", n, clear_leds());
+	BENCH("make_rgb565_color", n, image[b] = make_rgb565_color(b, s, b));
+	BENCH("commit_frame", n, set_led(b % ROW_SIZE, 0, b ^ s);
+	      commit_frame());
+	BENCH("commit_frame_full", n, set_leds_single_color(b);
+	      commit_frame());
+
+	clear_leds();
+	commit_frame();
+	close_led_matrix();
+	free(samples);
+	return 0;
+}
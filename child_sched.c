@@ -0,0 +1,213 @@
+/*
+ * child_sched.c
+ *
+ * This file contains functions for placing the children of a scheduling
+ * experiment. See child_sched.h for an overview.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "child_sched.h"
+
+/*
+ * cgroup v2 cpu.weight (100 = nice 0) matching the kernel's CFS weights
+ * for nice 0 to 19
+ */
+static const int nice_weights[] = {
+	100, 80, 64, 51, 41, 33, 27, 21, 17, 13,
+	11, 8, 7, 5, 4, 4, 3, 2, 2, 1,
+};
+#define NUM_NICE_WEIGHTS (sizeof(nice_weights) / sizeof(nice_weights[0]))
+
+static const struct {
+	const char *name;
+	int policy;
+} policies[] = {
+	{"other", SCHED_OTHER},
+	{"batch", SCHED_BATCH},
+	{"idle", SCHED_IDLE},
+	{"fifo", SCHED_FIFO},
+	{"rr", SCHED_RR},
+};
+
+/*
+ * Initialize <cfg> to SCHED_OTHER, no pinning, no cgroups and a nice step
+ * of 1.
+ */
+void child_sched_init(struct child_sched *cfg) {
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->policy = SCHED_OTHER;
+	cfg->nice_step = 1;
+}
+
+/*
+ * Set the policy of <cfg> from <name>: "other", "batch", "idle", "fifo"
+ * or "rr".
+ *
+ * Returns 0 on success and -1 if there is no such policy.
+ */
+int child_sched_set_policy(struct child_sched *cfg, const char *name) {
+
+	for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+		if (strcmp(name, policies[i].name) == 0) {
+			cfg->policy = policies[i].policy;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Set the affinity of <cfg> from <spec>: "none", "spread" (one child per
+ * online CPU, wrapping around) or a comma-separated list of CPU numbers.
+ *
+ * Returns 0 on success and -1 if <spec> is invalid.
+ */
+int child_sched_set_affinity(struct child_sched *cfg, const char *spec) {
+
+	if (strcmp(spec, "none") == 0) {
+		cfg->num_cpus = 0;
+		return 0;
+	}
+	if (strcmp(spec, "spread") == 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		if (n < 1) {
+			return -1;
+		}
+		if (n > MAX_AFFINITY_CPUS) {
+			n = MAX_AFFINITY_CPUS;
+		}
+		cfg->num_cpus = n;
+		for (int i = 0; i < n; i++) {
+			cfg->cpus[i] = i;
+		}
+		return 0;
+	}
+
+	cfg->num_cpus = 0;
+	while (*spec != '\0') {
+		char *end;
+		long cpu = strtol(spec, &end, 10);
+		if (end == spec || cpu < 0 || cpu >= CPU_SETSIZE ||
+		    cfg->num_cpus == MAX_AFFINITY_CPUS ||
+		    (*end != ',' && *end != '\0')) {
+			cfg->num_cpus = 0;
+			return -1;
+		}
+		cfg->cpus[cfg->num_cpus++] = cpu;
+		spec = *end == ',' ? end + 1 : end;
+	}
+	return cfg->num_cpus > 0 ? 0 : -1;
+}
+
+/* Write the string <value> to the file <dir>/<name> */
+static int write_cgroup_file(const char *dir, const char *name,
+			     const char *value) {
+
+	char path[512];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "w");
+	if (f == NULL) {
+		perror("Error on call to fopen()");
+		return -1;
+	}
+	if (fputs(value, f) == EOF) {
+		perror("Error on call to fputs()");
+		fclose(f);
+		return -1;
+	}
+	if (fclose(f) == EOF) {
+		perror("Error on call to fclose()");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Move the calling thread into the subgroup "child<n>" of <parent>, with
+ * a cpu.weight equivalent to nice <level>. A single-threaded process is
+ * moved as a whole, a thread of a multi-threaded process on its own
+ * (which requires a threaded cgroup).
+ */
+static int join_cgroup(const char *parent, int n, int level, pid_t tid) {
+
+	char dir[512], value[32];
+	int w = level < (int)NUM_NICE_WEIGHTS ? level :
+		(int)NUM_NICE_WEIGHTS - 1;
+
+	snprintf(dir, sizeof(dir), "%s/child%d", parent, n);
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+		perror("Error on call to mkdir()");
+		return -1;
+	}
+	snprintf(value, sizeof(value), "%d\n", nice_weights[w]);
+	if (write_cgroup_file(dir, "cpu.weight", value) == -1) {
+		return -1;
+	}
+	snprintf(value, sizeof(value), "%d\n", (int)tid);
+	return write_cgroup_file(dir, tid == getpid() ?
+				 "cgroup.procs" : "cgroup.threads", value);
+}
+
+/*
+ * Apply the settings in <cfg> for child <n> to the calling thread.
+ * With a cgroup, the child is moved into the subgroup "child<n>" of
+ * <cfg->cgroup> after setting its cpu.weight to match its nice level.
+ * The parent cgroup must already have the cpu controller enabled in
+ * cgroup.subtree_control.
+ *
+ * Returns 0 on success and -1 if any setting failed.
+ */
+int child_sched_apply(const struct child_sched *cfg, int n) {
+
+	pid_t tid = syscall(SYS_gettid);
+	struct sched_param param = {0};
+	int level = n * cfg->nice_step;
+	int ret = 0;
+
+	if (cfg->num_cpus > 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cfg->cpus[n % cfg->num_cpus], &set);
+		if (sched_setaffinity(tid, sizeof(set), &set) == -1) {
+			perror("Error on call to sched_setaffinity()");
+			ret = -1;
+		}
+	}
+
+	if (cfg->policy == SCHED_FIFO || cfg->policy == SCHED_RR) {
+		int max = sched_get_priority_max(cfg->policy);
+		int min = sched_get_priority_min(cfg->policy);
+		param.sched_priority = max - level > min ? max - level : min;
+	}
+	if (sched_setscheduler(tid, cfg->policy, &param) == -1) {
+		perror("Error on call to sched_setscheduler()");
+		ret = -1;
+	}
+
+	/* Niceness only matters to the non-real-time policies */
+	if (cfg->policy != SCHED_FIFO && cfg->policy != SCHED_RR &&
+	    setpriority(PRIO_PROCESS, tid, level) == -1) {
+		perror("Error on call to setpriority()");
+		ret = -1;
+	}
+
+	if (cfg->cgroup != NULL &&
+	    join_cgroup(cfg->cgroup, n, level, tid) == -1) {
+		ret = -1;
+	}
+	return ret;
+}
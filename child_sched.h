@@ -0,0 +1,62 @@
+/*
+ * child_sched.h
+ *
+ * This file contains declarations of functions for placing the children
+ * of a scheduling experiment: CPU affinity, scheduling policy and
+ * priority, and cgroup CPU weight.
+ *
+ * Child n is given priority level n * nice_step of the chosen policy,
+ * with child 0 getting the highest priority, like nice(n * nice_step)
+ * does for the default policy. The settings apply to the calling thread,
+ * so the same function is used right after fork() and at the start of a
+ * pool worker.
+ */
+
+#ifndef CHILD_SCHED_H
+#define CHILD_SCHED_H
+
+/* Maximum number of CPUs in an affinity list */
+#define MAX_AFFINITY_CPUS 64
+
+struct child_sched {
+	int policy;		/* SCHED_OTHER, SCHED_BATCH, ... */
+	int num_cpus;		/* 0 means no pinning */
+	int cpus[MAX_AFFINITY_CPUS];	/* Child n runs on cpus[n % num_cpus] */
+	const char *cgroup;	/* Parent cgroup v2 directory, or NULL */
+	int nice_step;		/* Priority levels between children */
+};
+
+/*
+ * Initialize <cfg> to SCHED_OTHER, no pinning, no cgroups and a nice step
+ * of 1.
+ */
+void child_sched_init(struct child_sched *cfg);
+
+/*
+ * Set the policy of <cfg> from <name>: "other", "batch", "idle", "fifo"
+ * or "rr".
+ *
+ * Returns 0 on success and -1 if there is no such policy.
+ */
+int child_sched_set_policy(struct child_sched *cfg, const char *name);
+
+/*
+ * Set the affinity of <cfg> from <spec>: "none", "spread" (one child per
+ * online CPU, wrapping around) or a comma-separated list of CPU numbers.
+ *
+ * Returns 0 on success and -1 if <spec> is invalid.
+ */
+int child_sched_set_affinity(struct child_sched *cfg, const char *spec);
+
+/*
+ * Apply the settings in <cfg> for child <n> to the calling thread.
+ * With a cgroup, the child is moved into the subgroup "child<n>" of
+ * <cfg->cgroup> after setting its cpu.weight to match its nice level.
+ * The parent cgroup must already have the cpu controller enabled in
+ * cgroup.subtree_control.
+ *
+ * Returns 0 on success and -1 if any setting failed.
+ */
+int child_sched_apply(const struct child_sched *cfg, int n);
+
+#endif
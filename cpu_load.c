@@ -0,0 +1,197 @@
+/*
+ * cpu_load.c
+ *
+ * This file contains functions for generating a reproducible amount of
+ * CPU load. See cpu_load.h for an overview.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu_load.h"
+
+/* Work per iteration of each kernel */
+#define INT_STEPS 256
+#define FP_STEPS 256
+#define STREAM_WORDS 512
+#define THRASH_LOADS 64
+
+/* Minimum CPU time spent calibrating */
+#define CALIBRATE_NS 50000000L
+
+#define BUFFER_WORDS (CPU_LOAD_BUFFER_SIZE / sizeof(uint64_t))
+
+volatile uint64_t cpu_load_sink;
+
+static const char *profile_names[NUM_LOAD_PROFILES] = {
+	"int", "fp", "stream", "thrash"
+};
+
+static double rate[NUM_LOAD_PROFILES];
+
+/*
+ * Buffer for the memory profiles, and positions kept between calls. The
+ * buffer is shared, but each thread walks it from its own position.
+ */
+static uint64_t *buffer;
+static _Thread_local size_t stream_pos;
+static _Thread_local size_t thrash_pos;
+
+/*
+ * Allocate the buffer. For LOAD_THRASH it holds a single random cycle
+ * through all words (Sattolo's algorithm), so each load depends on the
+ * previous one and the hardware prefetcher cannot help.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+static int init_buffer() {
+
+	uint64_t x = 88172645463325252ULL;
+
+	if (buffer != NULL) {
+		return 0;
+	}
+	buffer = malloc(CPU_LOAD_BUFFER_SIZE);
+	if (buffer == NULL) {
+		perror("Error on call to malloc()");
+		return -1;
+	}
+	for (size_t i = 0; i < BUFFER_WORDS; i++) {
+		buffer[i] = i;
+	}
+	for (size_t i = BUFFER_WORDS - 1; i > 0; i--) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		size_t j = x % i;
+		uint64_t tmp = buffer[i];
+		buffer[i] = buffer[j];
+		buffer[j] = tmp;
+	}
+	return 0;
+}
+
+static long thread_cpu_ns() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * Returns the profile named <name> ("int", "fp", "stream" or "thrash"),
+ * or -1 if there is no such profile.
+ */
+int cpu_load_profile_from_name(const char *name) {
+
+	for (int i = 0; i < NUM_LOAD_PROFILES; i++) {
+		if (strcmp(name, profile_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Returns the name of <profile>. */
+const char *cpu_load_profile_name(enum cpu_load_profile profile) {
+
+	return profile_names[profile];
+}
+
+/* Run <iterations> iterations of the <profile> kernel. */
+void cpu_load_run(enum cpu_load_profile profile, long iterations) {
+
+	uint64_t x = cpu_load_sink | 1;
+	double f = 2.0;
+
+	if ((profile == LOAD_STREAM || profile == LOAD_THRASH) &&
+	    init_buffer() == -1) {
+		return;
+	}
+
+	switch (profile) {
+	case LOAD_INT:
+		for (long n = 0; n < iterations; n++) {
+			for (int i = 0; i < INT_STEPS; i++) {
+				x ^= x << 13;
+				x ^= x >> 7;
+				x ^= x << 17;
+			}
+		}
+		break;
+	case LOAD_FP:
+		for (long n = 0; n < iterations; n++) {
+			for (int i = 0; i < FP_STEPS; i++) {
+				/* Converges towards 1, so it never overflows */
+				f = f * 0.9999999 + 0.0000001;
+			}
+		}
+		memcpy(&x, &f, sizeof(x));
+		break;
+	case LOAD_STREAM:
+		for (long n = 0; n < iterations; n++) {
+			if (stream_pos + STREAM_WORDS > BUFFER_WORDS) {
+				stream_pos = 0;
+			}
+			for (int i = 0; i < STREAM_WORDS; i++) {
+				x += buffer[stream_pos + i];
+			}
+			stream_pos += STREAM_WORDS;
+		}
+		break;
+	case LOAD_THRASH:
+		for (long n = 0; n < iterations; n++) {
+			for (int i = 0; i < THRASH_LOADS; i++) {
+				thrash_pos = buffer[thrash_pos];
+			}
+		}
+		x = thrash_pos;
+		break;
+	default:
+		break;
+	}
+	cpu_load_sink = x;
+}
+
+/*
+ * Measure the number of iterations of <profile> per second of CPU time.
+ * Should be called before forking, so that all children share the result
+ * and the memory buffer.
+ *
+ * Returns the measured rate on success and -1 on error.
+ */
+double cpu_load_calibrate(enum cpu_load_profile profile) {
+
+	long iterations = 1, elapsed;
+
+	if ((profile == LOAD_STREAM || profile == LOAD_THRASH) &&
+	    init_buffer() == -1) {
+		return -1;
+	}
+
+	/* Warm up, then double the iterations until it takes long enough */
+	cpu_load_run(profile, iterations);
+	for (;;) {
+		long start = thread_cpu_ns();
+		cpu_load_run(profile, iterations);
+		elapsed = thread_cpu_ns() - start;
+		if (elapsed >= CALIBRATE_NS) {
+			break;
+		}
+		iterations *= 2;
+	}
+	rate[profile] = iterations * 1e9 / elapsed;
+	return rate[profile];
+}
+
+/*
+ * Run as many iterations of <profile> as take <ns> nanoseconds of CPU
+ * time according to the last cpu_load_calibrate() of that profile.
+ */
+void cpu_load_run_ns(enum cpu_load_profile profile, long ns) {
+
+	cpu_load_run(profile, (long)(rate[profile] * ns / 1e9));
+}
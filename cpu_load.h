@@ -0,0 +1,65 @@
+/*
+ * cpu_load.h
+ *
+ * This file contains declarations of functions for generating a
+ * reproducible amount of CPU load.
+ *
+ * Work is done in iterations of a fixed kernel, chosen by a load profile.
+ * cpu_load_calibrate() measures how many iterations the current CPU
+ * completes per second of CPU time, after which cpu_load_run_ns() does the
+ * amount of work that takes the given time on an otherwise idle CPU.
+ * Because the amount of work is fixed up front, a unit of work takes
+ * longer in wall-clock time when the caller is preempted, which is what
+ * scheduling experiments want to observe.
+ *
+ * Every kernel stores its result in cpu_load_sink, so the compiler cannot
+ * eliminate it regardless of optimization level.
+ */
+
+#ifndef CPU_LOAD_H
+#define CPU_LOAD_H
+
+#include <stdint.h>
+
+enum cpu_load_profile {
+	LOAD_INT,	/* Integer ALU, no memory traffic */
+	LOAD_FP,	/* Floating point multiply-add chain */
+	LOAD_STREAM,	/* Sequential reads through a large buffer */
+	LOAD_THRASH,	/* Dependent random reads that miss in the caches */
+	NUM_LOAD_PROFILES
+};
+
+/* Size of the buffer used by LOAD_STREAM and LOAD_THRASH */
+#define CPU_LOAD_BUFFER_SIZE (16 * 1024 * 1024)
+
+/* Result sink for all kernels */
+extern volatile uint64_t cpu_load_sink;
+
+/*
+ * Returns the profile named <name> ("int", "fp", "stream" or "thrash"),
+ * or -1 if there is no such profile.
+ */
+int cpu_load_profile_from_name(const char *name);
+
+/* Returns the name of <profile>. */
+const char *cpu_load_profile_name(enum cpu_load_profile profile);
+
+/*
+ * Measure the number of iterations of <profile> per second of CPU time.
+ * Should be called before forking, so that all children share the result
+ * and the memory buffer.
+ *
+ * Returns the measured rate on success and -1 on error.
+ */
+double cpu_load_calibrate(enum cpu_load_profile profile);
+
+/* Run <iterations> iterations of the <profile> kernel. */
+void cpu_load_run(enum cpu_load_profile profile, long iterations);
+
+/*
+ * Run as many iterations of <profile> as take <ns> nanoseconds of CPU
+ * time according to the last cpu_load_calibrate() of that profile.
+ */
+void cpu_load_run_ns(enum cpu_load_profile profile, long ns);
+
+#endif
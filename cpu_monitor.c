@@ -0,0 +1,382 @@
+/*
+ * cpu_monitor.c
+ *
+ * This file contains functions for sampling CPU utilization and showing it
+ * on an LED matrix. See cpu_monitor.h for an overview.
+ *
+ * Core utilization is the share of non-idle jiffies in the "cpuN" lines
+ * of /proc/stat, where idle includes iowait and the guest columns are not
+ * counted twice. Task usage is utime + stime from /proc/<pid>/stat over
+ * the wall-clock time between samples.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "led_matrix.h"
+#include "cpu_monitor.h"
+
+/* Enough for the cpu lines of CPU_MONITOR_MAX_CPUS cores */
+#define STAT_BUFFER_SIZE 16384
+#define TASK_BUFFER_SIZE 1024
+
+/* Columns of a cpu line counted in the total: user to steal */
+#define STAT_COLUMNS 8
+
+struct task {
+	int fd;			/* -1 once the task has exited */
+	uint64_t ticks;		/* utime + stime at the last sample */
+	double usage;
+};
+
+struct cpu_monitor {
+	int stat_fd;
+	int num_cpus;
+	uint64_t busy[CPU_MONITOR_MAX_CPUS];
+	uint64_t total[CPU_MONITOR_MAX_CPUS];
+	double util[CPU_MONITOR_MAX_CPUS];
+	int online[CPU_MONITOR_MAX_CPUS];	/* In the last sample */
+	int num_tasks;
+	struct task tasks[CPU_MONITOR_MAX_TASKS];
+	long ticks_per_sec;
+	int64_t sample_ns;	/* CLOCK_MONOTONIC of the last sample */
+	char buf[STAT_BUFFER_SIZE];
+};
+
+static int64_t now_ns() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Parse the decimal number at <p>, after any spaces, into <*v> */
+static const char *parse_u64(const char *p, uint64_t *v) {
+
+	uint64_t n = 0;
+
+	while (*p == ' ') {
+		p++;
+	}
+	while (*p >= '0' && *p <= '9') {
+		n = n * 10 + (*p++ - '0');
+	}
+	*v = n;
+	return p;
+}
+
+/* Returns the start of the line after the one <p> is on */
+static const char *next_line(const char *p) {
+
+	p = strchr(p, '\n');
+	return p == NULL ? "" : p + 1;
+}
+
+/*
+ * Read the cpu lines of /proc/stat, updating busy, total and util. Offline
+ * cores have no line, so each line is stored by its core number, and a
+ * core coming back online starts from a new baseline.
+ */
+static int sample_cpus(struct cpu_monitor *mon) {
+
+	ssize_t len = pread(mon->stat_fd, mon->buf, STAT_BUFFER_SIZE - 1, 0);
+	int seen[CPU_MONITOR_MAX_CPUS] = {0};
+	const char *p;
+	int n = 0;
+
+	if (len <= 0) {
+		perror("Error on call to pread()");
+		return -1;
+	}
+	mon->buf[len] = '\0';
+
+	/* The first line is the sum over all cores */
+	for (p = next_line(mon->buf); strncmp(p, "cpu", 3) == 0;
+	     p = next_line(p)) {
+		uint64_t index, v, total = 0, idle = 0;
+
+		p = parse_u64(p + 3, &index);
+		if (index >= CPU_MONITOR_MAX_CPUS) {
+			continue;
+		}
+		for (int c = 0; c < STAT_COLUMNS; c++) {
+			p = parse_u64(p, &v);
+			total += v;
+			if (c == 3 || c == 4) {	/* idle, iowait */
+				idle += v;
+			}
+		}
+		if (mon->online[index] && total > mon->total[index] &&
+		    total - idle >= mon->busy[index]) {
+			mon->util[index] = (double)(total - idle -
+						    mon->busy[index]) /
+				(total - mon->total[index]);
+		} else if (!mon->online[index]) {
+			mon->util[index] = 0;
+		}
+		mon->busy[index] = total - idle;
+		mon->total[index] = total;
+		seen[index] = 1;
+		if ((int)index >= n) {
+			n = index + 1;
+		}
+	}
+	for (int i = 0; i < CPU_MONITOR_MAX_CPUS; i++) {
+		mon->online[i] = seen[i];
+		if (!seen[i]) {
+			mon->util[i] = 0;
+		}
+	}
+	mon->num_cpus = n;
+	return 0;
+}
+
+/* Returns utime + stime of <task>, or -1 if it has exited */
+static int64_t task_ticks(struct task *task) {
+
+	char buf[TASK_BUFFER_SIZE];
+	ssize_t len = pread(task->fd, buf, sizeof(buf) - 1, 0);
+	const char *p;
+	uint64_t utime, stime;
+
+	if (len <= 0) {
+		return -1;
+	}
+	buf[len] = '\0';
+
+	/* The command name may contain spaces and parentheses */
+	p = strrchr(buf, ')');
+	if (p == NULL) {
+		return -1;
+	}
+	/* Skip ") state", then fields 4 to 13 */
+	p = strchr(p + 2, ' ');
+	for (int field = 4; p != NULL && field <= 13; field++) {
+		p = strchr(p + 1, ' ');
+	}
+	if (p == NULL) {
+		return -1;
+	}
+	p = parse_u64(p, &utime);
+	parse_u64(p, &stime);
+	return utime + stime;
+}
+
+/*
+ * Open /proc/stat and take a first sample, so that the next one measures
+ * the utilization in between.
+ *
+ * Returns a pointer to the monitor on success or NULL on error.
+ */
+struct cpu_monitor *cpu_monitor_create() {
+
+	struct cpu_monitor *mon = calloc(1, sizeof(*mon));
+	if (mon == NULL) {
+		perror("Error on call to calloc()");
+		return NULL;
+	}
+	mon->stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+	if (mon->stat_fd == -1) {
+		perror("Error on call to open()");
+		free(mon);
+		return NULL;
+	}
+	mon->ticks_per_sec = sysconf(_SC_CLK_TCK);
+	if (cpu_monitor_sample(mon) == -1) {
+		cpu_monitor_destroy(mon);
+		return NULL;
+	}
+	return mon;
+}
+
+/* Close all files of <mon> and free it. */
+void cpu_monitor_destroy(struct cpu_monitor *mon) {
+
+	if (mon == NULL) {
+		return;
+	}
+	for (int i = 0; i < mon->num_tasks; i++) {
+		if (mon->tasks[i].fd != -1) {
+			close(mon->tasks[i].fd);
+		}
+	}
+	close(mon->stat_fd);
+	free(mon);
+}
+
+/*
+ * Also track the CPU usage of process or thread <pid>.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int cpu_monitor_add_task(struct cpu_monitor *mon, pid_t pid) {
+
+	struct task *task;
+	char path[64];
+	int64_t ticks;
+
+	if (mon->num_tasks == CPU_MONITOR_MAX_TASKS) {
+		printf("Too many tasks to monitor\n");
+		return -1;
+	}
+	task = &mon->tasks[mon->num_tasks];
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	task->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (task->fd == -1) {
+		perror("Error on call to open()");
+		return -1;
+	}
+	ticks = task_ticks(task);
+	if (ticks == -1) {
+		printf("Could not read %s\n", path);
+		close(task->fd);
+		return -1;
+	}
+	task->ticks = ticks;
+	task->usage = 0;
+	mon->num_tasks++;
+	return 0;
+}
+
+/*
+ * Take a sample and update the utilization of every core and task since
+ * the previous one.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int cpu_monitor_sample(struct cpu_monitor *mon) {
+
+	int64_t now = now_ns();
+	double seconds = (now - mon->sample_ns) / 1e9;
+
+	if (sample_cpus(mon) == -1) {
+		return -1;
+	}
+	for (int i = 0; i < mon->num_tasks; i++) {
+		struct task *task = &mon->tasks[i];
+		int64_t ticks;
+
+		if (task->fd == -1) {
+			continue;
+		}
+		ticks = task_ticks(task);
+		if (ticks == -1) {
+			close(task->fd);
+			task->fd = -1;
+			task->usage = 0;
+			continue;
+		}
+		task->usage = (double)(ticks - task->ticks) /
+			mon->ticks_per_sec / seconds;
+		task->ticks = ticks;
+	}
+	mon->sample_ns = now;
+	return 0;
+}
+
+/*
+ * Returns one more than the highest core number found in /proc/stat.
+ * Offline cores below it have a utilization of 0.
+ */
+int cpu_monitor_num_cpus(const struct cpu_monitor *mon) {
+
+	return mon->num_cpus;
+}
+
+/*
+ * Returns the utilization of core <cpu> between the last two samples,
+ * from 0.0 (idle) to 1.0 (busy).
+ */
+double cpu_monitor_cpu(const struct cpu_monitor *mon, int cpu) {
+
+	if (cpu < 0 || cpu >= mon->num_cpus) {
+		return 0;
+	}
+	return mon->util[cpu];
+}
+
+/*
+ * Returns the CPU usage of the <task>:th task added, in CPUs, between the
+ * last two samples, or 0 if it has exited.
+ */
+double cpu_monitor_task(const struct cpu_monitor *mon, int task) {
+
+	if (task < 0 || task >= mon->num_tasks) {
+		return 0;
+	}
+	return mon->tasks[task].usage;
+}
+
+/* Returns the heat color, green through yellow to red, for <level>. */
+uint16_t cpu_monitor_color(double level) {
+
+	if (level < 0) {
+		level = 0;
+	}
+	if (level > 1) {
+		level = 1;
+	}
+	if (level < 0.5) {
+		return make_rgb565_color(510 * level, 255, 0);
+	}
+	return make_rgb565_color(255, 510 * (1 - level), 0);
+}
+
+/* Returns the number of LEDs of a bar of <length> LEDs lit at <level> */
+static int bar_length(double level, int length) {
+
+	int n = level * length + 0.5;
+	return n < 0 ? 0 : n > length ? length : n;
+}
+
+/*
+ * Draw the utilization of each core on <m> as a vertical bar, one column
+ * per core from the left, bottom up. With more than ROW_SIZE cores each
+ * column shows the mean of a group of neighbouring cores.
+ */
+void cpu_monitor_show_cpus(const struct cpu_monitor *mon, led_matrix_t *m) {
+
+	uint16_t image[NUM_LEDS] = {RGB565_OFF};
+	int group = (mon->num_cpus + ROW_SIZE - 1) / ROW_SIZE;
+
+	for (int col = 0; col < ROW_SIZE && col * group < mon->num_cpus;
+	     col++) {
+		double sum = 0;
+		int cores = 0, lit;
+
+		for (int c = col * group;
+		     c < (col + 1) * group && c < mon->num_cpus; c++) {
+			sum += mon->util[c];
+			cores++;
+		}
+		lit = bar_length(sum / cores, COL_SIZE);
+		for (int k = 0; k < lit; k++) {
+			image[(COL_SIZE - 1 - k) * ROW_SIZE + col] =
+				cpu_monitor_color((k + 1.0) / COL_SIZE);
+		}
+	}
+	led_matrix_set_image(m, image);
+}
+
+/*
+ * Draw the CPU usage of each task on <m> as a horizontal bar, one row per
+ * task from the top, where a full row is one whole CPU.
+ */
+void cpu_monitor_show_tasks(const struct cpu_monitor *mon, led_matrix_t *m) {
+
+	uint16_t image[NUM_LEDS] = {RGB565_OFF};
+
+	for (int row = 0; row < mon->num_tasks && row < COL_SIZE; row++) {
+		int lit = bar_length(mon->tasks[row].usage, ROW_SIZE);
+		for (int k = 0; k < lit; k++) {
+			image[row * ROW_SIZE + k] =
+				cpu_monitor_color((k + 1.0) / ROW_SIZE);
+		}
+	}
+	led_matrix_set_image(m, image);
+}
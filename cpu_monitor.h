@@ -0,0 +1,86 @@
+/*
+ * cpu_monitor.h
+ *
+ * This file contains declarations of functions for sampling per-core and
+ * per-task CPU utilization and showing it on an LED matrix.
+ *
+ * /proc/stat and /proc/<pid>/stat are opened once and every sample is a
+ * single pread() of each into a preallocated buffer, parsed by hand
+ * without stdio, so the monitor can run at a high rate without becoming
+ * part of the load it measures.
+ */
+
+#ifndef CPU_MONITOR_H
+#define CPU_MONITOR_H
+
+#include <sys/types.h>
+
+#include "led_matrix.h"
+
+/* Most cores and tasks tracked by one monitor */
+#define CPU_MONITOR_MAX_CPUS 64
+#define CPU_MONITOR_MAX_TASKS 8
+
+struct cpu_monitor;
+
+/*
+ * Open /proc/stat and take a first sample, so that the next one measures
+ * the utilization in between.
+ *
+ * Returns a pointer to the monitor on success or NULL on error.
+ */
+struct cpu_monitor *cpu_monitor_create();
+
+/* Close all files of <mon> and free it. */
+void cpu_monitor_destroy(struct cpu_monitor *mon);
+
+/*
+ * Also track the CPU usage of process or thread <pid>.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int cpu_monitor_add_task(struct cpu_monitor *mon, pid_t pid);
+
+/*
+ * Take a sample and update the utilization of every core and task since
+ * the previous one.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int cpu_monitor_sample(struct cpu_monitor *mon);
+
+/*
+ * Returns one more than the highest core number found in /proc/stat.
+ * Offline cores below it have a utilization of 0.
+ */
+int cpu_monitor_num_cpus(const struct cpu_monitor *mon);
+
+/*
+ * Returns the utilization of core <cpu> between the last two samples,
+ * from 0.0 (idle) to 1.0 (busy).
+ */
+double cpu_monitor_cpu(const struct cpu_monitor *mon, int cpu);
+
+/*
+ * Returns the CPU usage of the <task>:th task added, in CPUs, between the
+ * last two samples, or 0 if it has exited.
+ */
+double cpu_monitor_task(const struct cpu_monitor *mon, int task);
+
+/* Returns the heat color, green through yellow to red, for <level>. */
+uint16_t cpu_monitor_color(double level);
+
+/*
+ * Draw the utilization of each core on <m> as a vertical bar, one column
+ * per core from the left, bottom up. With more than ROW_SIZE cores each
+ * column shows the mean of a group of neighbouring cores.
+ */
+void cpu_monitor_show_cpus(const struct cpu_monitor *mon, led_matrix_t *m);
+
+/*
+ * Draw the CPU usage of each task on <m> as a horizontal bar, one row per
+ * task from the top, where a full row is one whole CPU.
+ */
+void cpu_monitor_show_tasks(const struct cpu_monitor *mon, led_matrix_t *m);
+
+#endif
@@ -1,55 +1,590 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
 #include "led_matrix.h"
+#include "led_shared.h"
+#include "work_pool.h"
+#include "cpu_load.h"
+#include "sched_trace.h"
+#include "child_sched.h"
+#include "sched_stats.h"
+#include "round_sync.h"
 
+/* How often the parent copies the shared frame to the LED matrix */
+#define COMPOSE_INTERVAL_MS 10
 
-void pointless_calculation() {
-        int amount = 100000000;
-	int x = 0;
-	for (int i = 0; i < amount; i++)
-		x += i;
+/* Default CPU time per unit of work, in milliseconds */
+#define DEFAULT_WORK_MS 250
+
+/* Samples kept per round when tracing */
+#define TRACE_CAPACITY 1024
+
+/* Most children in one round, one per row of the LED matrix */
+#define MAX_CHILDREN 8
+
+/* Default number of unrecorded rounds before each repeated configuration */
+#define DEFAULT_WARMUP 1
+
+/* What each child reports at the end of a round */
+struct child_result {
+	int64_t finish_ns;	/* CLOCK_MONOTONIC */
+	int64_t cpu_ns;		/* CPU time used by run_child() */
+};
+
+struct led_shared_frame *frame;
+uint32_t composed_generation;
+
+enum cpu_load_profile load_profile = LOAD_INT;
+long work_ns = DEFAULT_WORK_MS * 1000000L;
+
+struct sched_trace *trace;
+FILE *trace_out;
+
+struct child_sched sched_cfg;
+
+/* Shared with the children, one per child */
+struct child_result *results;
+
+/* Starts and finishes rounds, and when the current one started */
+struct round_sync *round_sync;
+int64_t round_start_ns;
+
+/* One calibrated unit of work, lighting one LED in run_child() */
+void work_unit() {
+	cpu_load_run_ns(load_profile, work_ns);
+}
+
+/* Record step <step> of child <n> if tracing is enabled */
+void trace_step(int n, int step){
+	if (trace != NULL)
+		sched_trace_record(trace, n, step);
+}
+
+/* Returns the current time of <clock> in nanoseconds */
+int64_t clock_ns(clockid_t clock){
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 void run_child(int n){
+	int64_t cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+
+	trace_step(n, 0);
 	for (int i = 0; i < 8; i++){
-		pointless_calculation();
-		set_led(n,i,RGB565_WHITE);
+		work_unit();
+		led_shared_set(frame,n,i,RGB565_WHITE);
+		trace_step(n, i + 1);
+	}
+	results[n].cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+	results[n].finish_ns = clock_ns(CLOCK_MONOTONIC);
+}
+
+/* Copy the shared frame to the LED matrix if any child has updated it */
+void compose(){
+	uint16_t image[NUM_LEDS];
+
+	if (led_shared_generation(frame) == composed_generation)
+		return;
+	composed_generation = led_shared_snapshot(frame, image);
+	set_leds_image(image);
+	commit_frame();
+}
+
+/*
+ * Sleep until <num_children> pool items have reported that they are done,
+ * composing frames while they run
+ */
+void wait_round(int num_children){
+	while (num_children > 0){
+		int done;
+
+		compose();
+		done = round_sync_wait(round_sync, COMPOSE_INTERVAL_MS);
+		if (done == -1)
+			break;
+		num_children -= done;
+	}
+	compose();
+}
+
+/*
+ * Sleep until the <num_children> children in <pids> have exited,
+ * composing frames while they run. A child that dies without reporting
+ * that it is done, or that cannot be waited for, counts as finished, so
+ * the round always ends.
+ */
+void wait_children(pid_t *pids, int num_children){
+	int remaining = num_children;
+
+	while (remaining > 0){
+		compose();
+		if (round_sync_wait(round_sync, COMPOSE_INTERVAL_MS) == -1)
+			break;
+		for (int n = 0; n < num_children; n++){
+			pid_t ret;
+
+			if (pids[n] <= 0)
+				continue;
+			ret = waitpid(pids[n], NULL, WNOHANG);
+			if (ret == pids[n] || (ret == -1 && errno != EINTR)){
+				pids[n] = 0;
+				remaining--;
+			}
+		}
+	}
+	/* Without the eventfd, block until the rest have exited */
+	for (int n = 0; n < num_children; n++)
+		if (pids[n] > 0)
+			waitpid(pids[n], NULL, 0);
+	compose();
+}
+
+/*
+ * Kill and reap the <num_children> children in <pids> of a round that
+ * could not be started
+ */
+void kill_children(const pid_t *pids, int num_children){
+	for (int n = 0; n < num_children; n++){
+		kill(pids[n], SIGKILL);
+		waitpid(pids[n], NULL, 0);
+	}
+}
+
+/*
+ * Run one round with a freshly forked process per child.
+ *
+ * Returns 0 on success and -1 if the round could not be started.
+ */
+int run_round_processes(int num_children){
+	pid_t pids[MAX_CHILDREN];
+
+	if (round_sync_begin(round_sync, num_children, 1) == -1)
+		return -1;
+	for (int n = 0; n < num_children; n++){
+		pid_t pid = fork();
+		if (pid == -1){
+			perror("Error on call to fork()");
+			/* Those forked wait on a barrier that cannot fill */
+			kill_children(pids, n);
+			round_sync_abandon(round_sync);
+			return -1;
+		}
+		pids[n] = pid;
+		if (pid == 0){
+			child_sched_apply(&sched_cfg, n);
+			round_sync_start(round_sync);
+			run_child(n);
+			round_sync_done(round_sync);
+			exit(0);
+		}
+	}
+	round_sync_start(round_sync);
+	round_start_ns = clock_ns(CLOCK_MONOTONIC);
+	wait_children(pids, num_children);
+	return 0;
+}
+
+/* Give pool worker <worker> the same placement a forked child <n> gets */
+void init_worker(int worker){
+	child_sched_apply(&sched_cfg, worker);
+}
+
+void run_child_item(void *arg){
+	run_child((int)(intptr_t)arg);
+	round_sync_done(round_sync);
+}
+
+/*
+ * Run one round as work items on <pool>. Child n is queued on worker n,
+ * but idle workers may steal it. There is no start barrier, since with
+ * fewer workers than children not all of them run at once.
+ *
+ * Returns 0 on success and -1 if the round could not be started.
+ */
+int run_round_threads(struct work_pool *pool, int num_children){
+	if (round_sync_begin(round_sync, num_children, 0) == -1)
+		return -1;
+	round_start_ns = clock_ns(CLOCK_MONOTONIC);
+	for (int n = 0; n < num_children; n++)
+		work_pool_submit(pool, n, run_child_item, (void *)(intptr_t)n);
+	wait_round(num_children);
+	work_pool_wait(pool);
+	return 0;
+}
+
+/* Leave the finished round on the LED matrix for one unit of work */
+void pause_round(){
+	struct timespec pause = {work_ns / 1000000000L, work_ns % 1000000000L};
+	nanosleep(&pause, NULL);
+}
+
+/*
+ * Run one round of <num_children> children on <pool>, or forked if NULL,
+ * and clear the LED matrix. If <hold> is nonzero, a finished round is
+ * first left on it by pause_round().
+ *
+ * Returns 0 on success and -1 if the round could not be started.
+ */
+int run_round(struct work_pool *pool, int num_children, int hold){
+	int ret;
+
+	if (pool != NULL)
+		ret = run_round_threads(pool, num_children);
+	else
+		ret = run_round_processes(num_children);
+	if (ret == 0 && hold)
+		pause_round();
+	led_shared_fill(frame, RGB565_OFF);
+	compose();
+	return ret;
+}
+
+/*
+ * Parse the comma-separated list of at most <max> numbers in <spec> into
+ * <list>, each in <min>..<max_value>.
+ *
+ * Returns the number of entries, or -1 if <spec> is invalid.
+ */
+int parse_list(const char *spec, int *list, int max, int min, int max_value){
+	int n = 0;
+
+	while (*spec != '\0'){
+		char *end;
+		long v = strtol(spec, &end, 10);
+		if (end == spec || v < min || v > max_value || n == max ||
+		    (*end != ',' && *end != '\0'))
+			return -1;
+		list[n++] = v;
+		spec = *end == ',' ? end + 1 : end;
+	}
+	return n > 0 ? n : -1;
+}
+
+/*
+ * Run <warmup> unrecorded and then <repeats> recorded rounds of
+ * <num_children> children on <pool>, or forked if NULL, with the current
+ * load profile and nice step, and print one CSV line per child.
+ *
+ * Returns 0 on success and -1 if a round could not be started.
+ */
+int run_config(struct work_pool *pool, int num_children, int warmup,
+	       int repeats){
+	struct sched_stat completion[MAX_CHILDREN], share[MAX_CHILDREN];
+
+	for (int i = 0; i < num_children; i++){
+		sched_stat_init(&completion[i]);
+		sched_stat_init(&share[i]);
 	}
+	for (int r = 0; r < warmup + repeats; r++){
+		if (run_round(pool, num_children, 0) == -1)
+			return -1;
+		if (r < warmup)
+			continue;
+		for (int i = 0; i < num_children; i++){
+			double ns = results[i].finish_ns - round_start_ns;
+			sched_stat_add(&completion[i], ns / 1e6);
+			sched_stat_add(&share[i], results[i].cpu_ns / ns);
+		}
+	}
+	for (int i = 0; i < num_children; i++)
+		printf("%s,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.4f,%.4f,%.4f\n",
+		       cpu_load_profile_name(load_profile),
+		       sched_cfg.nice_step, num_children, i, repeats,
+		       completion[i].mean, sched_stat_stddev(&completion[i]),
+		       sched_stat_ci95(&completion[i]), share[i].mean,
+		       sched_stat_stddev(&share[i]),
+		       sched_stat_ci95(&share[i]));
+	fflush(stdout);
+	return 0;
+}
+
+/*
+ * Run every combination of the load profiles, nice steps and numbers of
+ * children in the lists, each <warmup> times unrecorded and then
+ * <repeats> times, and print one CSV line per configuration and child
+ * with the mean, standard deviation and 95% confidence interval of its
+ * completion time (from the start of the round, in ms) and of its CPU
+ * share (CPU time over completion time, 1.0 being a whole CPU).
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int run_experiment(int num_threads, const int *profiles, int num_profiles,
+		   const int *nice_steps, int num_nice_steps,
+		   const int *counts, int num_counts, int warmup, int repeats){
+	printf("profile,nice_step,children,child,repeats,"
+	       "completion_ms_mean,completion_ms_stddev,completion_ms_ci95,"
+	       "cpu_share_mean,cpu_share_stddev,cpu_share_ci95\n");
+	/* Forked children must not inherit unwritten output */
+	fflush(stdout);
+	for (int p = 0; p < num_profiles; p++){
+		load_profile = profiles[p];
+		for (int s = 0; s < num_nice_steps; s++){
+			struct work_pool *pool = NULL;
+			int ret = 0;
+
+			/* Pool workers take their placement when created */
+			sched_cfg.nice_step = nice_steps[s];
+			if (num_threads > 0){
+				pool = work_pool_create(num_threads,
+							init_worker);
+				if (pool == NULL){
+					printf("Failed to create worker "
+					       "pool\n");
+					return -1;
+				}
+			}
+			for (int c = 0; ret == 0 && c < num_counts; c++)
+				ret = run_config(pool, counts[c], warmup,
+						 repeats);
+			if (pool != NULL)
+				work_pool_destroy(pool);
+			if (ret == -1)
+				return -1;
+		}
+	}
+	return 0;
 }
 
-int main(){
+void usage(const char *prog){
+	printf("Usage: %s [-t threads] [-l profile] [-u ms] [-o file]\n"
+	       "       [-a affinity] [-s policy] [-g cgroup]\n"
+	       "       [-r repeats] [-w warmup] [-n counts] [-N steps]\n"
+	       "       [-L profiles]\n"
+	       "  -t threads  run children on a pool of worker threads\n"
+	       "              instead of forking a process per child\n"
+	       "  -l profile  load profile: int, fp, stream or thrash\n"
+	       "              (default int)\n"
+	       "  -u ms       CPU time per unit of work (default %d)\n"
+	       "  -o file     write per-step scheduling samples as CSV\n"
+	       "              to file (- for stdout)\n"
+	       "  -a affinity pin child n to a CPU: none, spread, or a\n"
+	       "              list like 0,1,2,3 (default none)\n"
+	       "  -s policy   other, batch, idle, fifo or rr (default\n"
+	       "              other); child n gets the n:th priority\n"
+	       "  -g cgroup   put child n in cgroup/child<n> with a\n"
+	       "              cpu.weight equivalent to nice n\n"
+	       "  -r repeats  experiment mode: repeat each configuration\n"
+	       "              and print statistics per child as CSV\n"
+	       "  -w warmup   unrecorded rounds per configuration\n"
+	       "              (default %d)\n"
+	       "  -n counts   numbers of children, like 1,2,4,8\n"
+	       "              (default 1 to %d)\n"
+	       "  -N steps    nice steps: child n gets nice n*step\n"
+	       "              (default 1)\n"
+	       "  -L profiles load profiles, like int,stream (default -l)\n"
+	       "Set LED_MATRIX_BACKEND=memory to run without a Sense HAT.\n",
+	       prog, DEFAULT_WORK_MS, DEFAULT_WARMUP, MAX_CHILDREN);
+}
+
+int main(int argc, char *argv[]){
+
+	int num_threads = 0;
+	struct work_pool *pool = NULL;
+	int opt;
+
+	int repeats = 0, warmup = DEFAULT_WARMUP;
+	int counts[MAX_CHILDREN], num_counts = 0;
+	int nice_steps[MAX_CHILDREN], num_nice_steps = 0;
+	int profiles[NUM_LOAD_PROFILES], num_profiles = 0;
+	int ret = 0;
+
+	const char *trace_path = NULL;
+
+	child_sched_init(&sched_cfg);
+	while ((opt = getopt(argc, argv, "t:l:u:o:a:s:g:r:w:n:N:L:h")) != -1){
+		switch (opt){
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		case 'l':
+			load_profile = cpu_load_profile_from_name(optarg);
+			if ((int)load_profile == -1){
+				printf("Unknown load profile %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'u':
+			work_ns = atol(optarg) * 1000000L;
+			break;
+		case 'o':
+			trace_path = optarg;
+			break;
+		case 'a':
+			if (child_sched_set_affinity(&sched_cfg, optarg) == -1){
+				printf("Invalid affinity %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 's':
+			if (child_sched_set_policy(&sched_cfg, optarg) == -1){
+				printf("Unknown scheduling policy %s\n",
+				       optarg);
+				return -1;
+			}
+			break;
+		case 'g':
+			sched_cfg.cgroup = optarg;
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 'w':
+			warmup = atoi(optarg);
+			break;
+		case 'n':
+			num_counts = parse_list(optarg, counts, MAX_CHILDREN,
+						1, MAX_CHILDREN);
+			if (num_counts == -1){
+				printf("Invalid numbers of children %s\n",
+				       optarg);
+				return -1;
+			}
+			break;
+		case 'N':
+			num_nice_steps = parse_list(optarg, nice_steps,
+						    MAX_CHILDREN, 0, 19);
+			if (num_nice_steps == -1){
+				printf("Invalid nice steps %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'L':
+			num_profiles = 0;
+			for (char *name = strtok(optarg, ","); name != NULL;
+			     name = strtok(NULL, ",")){
+				int p = cpu_load_profile_from_name(name);
+				if (p == -1 ||
+				    num_profiles == NUM_LOAD_PROFILES){
+					printf("Invalid load profiles %s\n",
+					       name);
+					return -1;
+				}
+				profiles[num_profiles++] = p;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+
+	if (trace_path != NULL){
+		trace_out = strcmp(trace_path, "-") == 0 ?
+			stdout : fopen(trace_path, "w");
+		if (trace_out == NULL){
+			perror("Error on call to fopen()");
+			return -1;
+		}
+		trace = sched_trace_create(TRACE_CAPACITY);
+		if (trace == NULL){
+			printf("Failed to create scheduling trace\n");
+			return -1;
+		}
+	}
+
+	/* Only experiment mode goes through the load profiles */
+	if (num_profiles == 0 || repeats == 0){
+		profiles[0] = load_profile;
+		num_profiles = 1;
+	}
+	if (num_nice_steps == 0)
+		nice_steps[num_nice_steps++] = sched_cfg.nice_step;
+	if (num_counts == 0)
+		for (int n = 1; n <= MAX_CHILDREN; n++)
+			counts[num_counts++] = n;
+	if (repeats < 0 || warmup < 0){
+		printf("Invalid number of repeats or warmup rounds\n");
+		return -1;
+	}
+
+	for (int p = 0; p < num_profiles; p++){
+		if (cpu_load_calibrate(profiles[p]) == -1){
+			printf("Failed to calibrate CPU load\n");
+			return -1;
+		}
+	}
+
+	results = mmap(NULL, MAX_CHILDREN * sizeof(*results),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		       -1, 0);
+	if (results == MAP_FAILED){
+		perror("Error on call to mmap()");
+		return -1;
+	}
+
+	round_sync = round_sync_create();
+	if (round_sync == NULL){
+		printf("Failed to create round synchronization\n");
+		return -1;
+	}
 
         if (open_led_matrix() == -1) {
                 printf("Failed to initialize LED matrix\n");
                 return -1;
         }
 
+        frame = led_shared_create();
+        if (frame == NULL) {
+                printf("Failed to create shared frame\n");
+                close_led_matrix();
+                return -1;
+        }
+
+	if (num_threads > 0 && repeats == 0){
+		pool = work_pool_create(num_threads, init_worker);
+		if (pool == NULL){
+			printf("Failed to create worker pool\n");
+			led_shared_destroy(frame);
+			close_led_matrix();
+			return -1;
+		}
+	}
+
         clear_leds();
+        commit_frame();
 	
-        for (int num_children = 1; num_children <= 8; num_children++){
-            for (int n = 0; n < num_children; n++){
-                pid_t pid = fork();
-                if (pid == 0){
-                    nice(n);
-                    run_child(n);
-					exit(0);
-                }
-            }
-			for (int n = 0; n < num_children; n++)
-						wait(NULL);
-			pointless_calculation();
-			clear_leds();
-					
+	if (repeats > 0)
+		ret = run_experiment(num_threads, profiles, num_profiles,
+				     nice_steps, num_nice_steps, counts,
+				     num_counts, warmup, repeats);
+        for (int c = 0; repeats == 0 && c < num_counts; c++){
+		int num_children = counts[c];
+
+		if (trace != NULL)
+			sched_trace_set_round(trace, num_children);
+		if (run_round(pool, num_children, 1) == -1){
+			printf("Failed to start round\n");
+			ret = -1;
+			break;
+		}
+		if (trace != NULL)
+			sched_trace_dump_csv(trace, trace_out, c == 0);
         }
 
+	if (pool != NULL)
+		work_pool_destroy(pool);
+        led_shared_destroy(frame);
+	munmap(results, MAX_CHILDREN * sizeof(*results));
+	round_sync_destroy(round_sync);
+	if (trace != NULL){
+		sched_trace_destroy(trace);
+		if (trace_out != stdout)
+			fclose(trace_out);
+	}
+
         if (close_led_matrix() == -1) {
                 printf("Could not properly close LED matrix\n");
                 return -1;
         }
 
-        return 0;
+        return ret;
 }
-
@@ -0,0 +1,296 @@
+/*
+ * led_anim.c
+ *
+ * This file contains functions for writing and playing back LED matrix
+ * animation files. See led_anim.h for the file format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "led_matrix.h"
+#include "led_anim.h"
+#include "led_timer.h"
+
+#define NUM_ROWS (NUM_LEDS / ROW_SIZE)
+#define ROW_BYTES (ROW_SIZE * sizeof(uint16_t))
+#define ALL_ROWS ((1u << NUM_ROWS) - 1)
+
+struct led_anim {
+	const uint8_t *map;
+	size_t size;
+	const struct led_anim_header *header;
+	uint32_t frame;		/* Next frame to show */
+	size_t offset;		/* File offset of the next frame */
+	uint16_t image[NUM_LEDS];	/* Current frame, for delta files */
+};
+
+/*
+ * Write the <num_frames> frames of NUM_LEDS RGB565 pixels in <frames> to
+ * the animation file <path>, to be played at <fps> frames per second.
+ * If <delta> is nonzero, only changed rows are stored.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_anim_write(const char *path, const uint16_t *frames,
+		   uint32_t num_frames, uint32_t fps, int delta) {
+
+	struct led_anim_header header;
+	FILE *f;
+	int ret = 0;
+
+	memcpy(header.magic, LED_ANIM_MAGIC, sizeof(header.magic));
+	header.version = LED_ANIM_VERSION;
+	header.flags = delta ? LED_ANIM_DELTA : 0;
+	header.num_frames = num_frames;
+	header.fps = fps;
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		perror("Error on call to fopen()");
+		return -1;
+	}
+	if (fwrite(&header, sizeof(header), 1, f) != 1) {
+		ret = -1;
+	}
+	for (uint32_t i = 0; i < num_frames && ret == 0; i++) {
+		const uint16_t *frame = frames + (size_t)i * NUM_LEDS;
+		if (!delta) {
+			if (fwrite(frame, LED_MATRIX_FILESIZE, 1, f) != 1) {
+				ret = -1;
+			}
+			continue;
+		}
+
+		uint8_t rows = 0;
+		for (int r = 0; r < NUM_ROWS; r++) {
+			if (i == 0 || memcmp(frame + r * ROW_SIZE,
+					     frame - NUM_LEDS + r * ROW_SIZE,
+					     ROW_BYTES) != 0) {
+				rows |= 1u << r;
+			}
+		}
+		if (fwrite(&rows, 1, 1, f) != 1) {
+			ret = -1;
+		}
+		for (int r = 0; r < NUM_ROWS && ret == 0; r++) {
+			const uint16_t *row = frame + r * ROW_SIZE;
+			if ((rows & (1u << r)) &&
+			    fwrite(row, ROW_BYTES, 1, f) != 1) {
+				ret = -1;
+			}
+		}
+	}
+	if (ret == -1) {
+		perror("Error on call to fwrite()");
+	}
+	if (fclose(f) == EOF) {
+		perror("Error on call to fclose()");
+		ret = -1;
+	}
+	return ret;
+}
+
+/*
+ * Map the animation file <path> into memory and check its header,
+ * including that the file size fits its number of frames.
+ *
+ * Returns a pointer to the animation on success or NULL on error.
+ */
+struct led_anim *led_anim_open(const char *path) {
+
+	struct led_anim *anim;
+	struct stat st;
+	uint64_t frames, data;
+	int fd, bad;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror("Error on call to open()");
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1) {
+		perror("Error on call to fstat()");
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(struct led_anim_header)) {
+		printf("%s is not an animation file\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	anim = calloc(1, sizeof(*anim));
+	if (anim == NULL) {
+		perror("Error on call to calloc()");
+		close(fd);
+		return NULL;
+	}
+	anim->size = st.st_size;
+	anim->map = mmap(NULL, anim->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (anim->map == MAP_FAILED) {
+		perror("Error on call to mmap()");
+		free(anim);
+		return NULL;
+	}
+	madvise((void *)anim->map, anim->size, MADV_SEQUENTIAL);
+
+	anim->header = (const struct led_anim_header *)anim->map;
+	if (memcmp(anim->header->magic, LED_ANIM_MAGIC, 4) != 0 ||
+	    anim->header->version != LED_ANIM_VERSION ||
+	    anim->header->num_frames == 0) {
+		printf("%s is not a supported animation file\n", path);
+		led_anim_close(anim);
+		return NULL;
+	}
+	frames = anim->header->num_frames;
+	data = anim->size - sizeof(struct led_anim_header);
+	if (!(anim->header->flags & LED_ANIM_DELTA)) {
+		bad = data < frames * LED_MATRIX_FILESIZE;
+	} else {
+		/* A delta frame is a row mask and 0 to NUM_ROWS rows */
+		bad = data < frames ||
+			data > frames * (1 + LED_MATRIX_FILESIZE);
+	}
+	if (bad) {
+		printf("%s does not match its number of frames\n", path);
+		led_anim_close(anim);
+		return NULL;
+	}
+	anim->offset = sizeof(struct led_anim_header);
+	return anim;
+}
+
+/*
+ * Unmap and free an animation opened with led_anim_open().
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_anim_close(struct led_anim *anim) {
+
+	int ret = 0;
+	if (munmap((void *)anim->map, anim->size) == -1) {
+		perror("Error on call to munmap()");
+		ret = -1;
+	}
+	free(anim);
+	return ret;
+}
+
+/* Returns the number of frames in <anim>. */
+uint32_t led_anim_num_frames(const struct led_anim *anim) {
+
+	return anim->header->num_frames;
+}
+
+/* Returns the intended frame rate of <anim>. */
+uint32_t led_anim_fps(const struct led_anim *anim) {
+
+	return anim->header->fps;
+}
+
+/*
+ * Put the next frame of <anim> in the back buffer of <m> without
+ * committing it.
+ *
+ * Returns 0 on success and -1 if the file is truncated or corrupt.
+ */
+static int load_next_frame(struct led_anim *anim, led_matrix_t *m) {
+
+	if (anim->frame == anim->header->num_frames) {
+		anim->frame = 0;
+		anim->offset = sizeof(struct led_anim_header);
+	}
+
+	if (!(anim->header->flags & LED_ANIM_DELTA)) {
+		/* Size checked in led_anim_open() */
+		led_matrix_set_image(m, (const uint16_t *)(anim->map +
+							   anim->offset));
+		anim->offset += LED_MATRIX_FILESIZE;
+	} else {
+		if (anim->offset >= anim->size) {
+			printf("Animation file is truncated\n");
+			return -1;
+		}
+		uint8_t rows = anim->map[anim->offset++];
+		for (int r = 0; r < NUM_ROWS; r++) {
+			if (!(rows & (1u << r))) {
+				continue;
+			}
+			if (anim->offset + ROW_BYTES > anim->size) {
+				printf("Animation file is truncated\n");
+				return -1;
+			}
+			memcpy(anim->image + r * ROW_SIZE,
+			       anim->map + anim->offset, ROW_BYTES);
+			anim->offset += ROW_BYTES;
+		}
+		led_matrix_set_image(m, anim->image);
+	}
+	anim->frame++;
+	return 0;
+}
+
+/*
+ * Show the next frame of <anim> on <m> and commit it. After the last
+ * frame, playback starts over from the first.
+ *
+ * Returns 0 on success and -1 if the file is truncated or corrupt.
+ */
+int led_anim_next_frame(struct led_anim *anim, led_matrix_t *m) {
+
+	if (load_next_frame(anim, m) == -1) {
+		return -1;
+	}
+	led_matrix_commit(m);
+	return 0;
+}
+
+/*
+ * Play <anim> on <m> <loops> times (forever if 0) at <fps> frames per
+ * second, or at the rate in the file if <fps> is 0. Frames are paced by a
+ * frame timer, so the rate does not drift, and frames whose time has
+ * passed are skipped rather than shown late.
+ *
+ * Returns 0 on success and -1 on error or if <loops> is negative.
+ */
+int led_anim_play(struct led_anim *anim, led_matrix_t *m, uint32_t fps,
+		  int loops) {
+
+	struct led_frame_timer timer;
+	uint64_t total;
+
+	if (loops < 0) {
+		printf("Invalid number of loops %d\n", loops);
+		return -1;
+	}
+	total = (uint64_t)loops * anim->header->num_frames;
+	if (fps == 0) {
+		fps = anim->header->fps;
+	}
+	if (led_frame_timer_init(&timer, fps) == -1) {
+		return -1;
+	}
+
+	for (uint64_t shown = 0; loops == 0 || shown < total; shown++) {
+		if (led_anim_next_frame(anim, m) == -1) {
+			return -1;
+		}
+		/* Skipped frames still have to be applied for delta files */
+		for (int skip = led_frame_timer_wait(&timer);
+		     skip > 0 && (loops == 0 || shown + 1 < total); skip--) {
+			if (load_next_frame(anim, m) == -1) {
+				return -1;
+			}
+			shown++;
+		}
+	}
+	return 0;
+}
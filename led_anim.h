@@ -0,0 +1,92 @@
+/*
+ * led_anim.h
+ *
+ * This file contains declarations of functions for writing and playing
+ * back LED matrix animation files.
+ *
+ * An animation file is a struct led_anim_header followed by the frames,
+ * all in native byte order (little-endian on the Raspberry Pi). Without
+ * LED_ANIM_DELTA every frame is NUM_LEDS RGB565 pixels (128 bytes). With
+ * LED_ANIM_DELTA every frame is one byte whose bit r is set if row r
+ * changed since the previous frame, followed by the pixels of just those
+ * rows; the first frame has all bits set.
+ *
+ * The player maps the file into memory and copies frames straight from
+ * the mapping, so playback does no parsing ahead of time and no
+ * allocation per frame.
+ */
+
+#ifndef LED_ANIM_H
+#define LED_ANIM_H
+
+#include <stdint.h>
+
+#include "led_matrix.h"
+
+#define LED_ANIM_MAGIC "LEDA"
+#define LED_ANIM_VERSION 1
+
+/* Header flags */
+#define LED_ANIM_DELTA 0x0001
+
+struct led_anim_header {
+	char magic[4];		/* LED_ANIM_MAGIC */
+	uint16_t version;	/* LED_ANIM_VERSION */
+	uint16_t flags;
+	uint32_t num_frames;
+	uint32_t fps;		/* Intended frame rate */
+};
+
+struct led_anim;
+
+/*
+ * Write the <num_frames> frames of NUM_LEDS RGB565 pixels in <frames> to
+ * the animation file <path>, to be played at <fps> frames per second.
+ * If <delta> is nonzero, only changed rows are stored.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_anim_write(const char *path, const uint16_t *frames,
+		   uint32_t num_frames, uint32_t fps, int delta);
+
+/*
+ * Map the animation file <path> into memory and check its header,
+ * including that the file size fits its number of frames.
+ *
+ * Returns a pointer to the animation on success or NULL on error.
+ */
+struct led_anim *led_anim_open(const char *path);
+
+/*
+ * Unmap and free an animation opened with led_anim_open().
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_anim_close(struct led_anim *anim);
+
+/* Returns the number of frames in <anim>. */
+uint32_t led_anim_num_frames(const struct led_anim *anim);
+
+/* Returns the intended frame rate of <anim>. */
+uint32_t led_anim_fps(const struct led_anim *anim);
+
+/*
+ * Show the next frame of <anim> on <m> and commit it. After the last
+ * frame, playback starts over from the first.
+ *
+ * Returns 0 on success and -1 if the file is truncated or corrupt.
+ */
+int led_anim_next_frame(struct led_anim *anim, led_matrix_t *m);
+
+/*
+ * Play <anim> on <m> <loops> times (forever if 0) at <fps> frames per
+ * second, or at the rate in the file if <fps> is 0. Frames are paced by a
+ * frame timer, so the rate does not drift, and frames whose time has
+ * passed are skipped rather than shown late.
+ *
+ * Returns 0 on success and -1 on error or if <loops> is negative.
+ */
+int led_anim_play(struct led_anim *anim, led_matrix_t *m, uint32_t fps,
+		  int loops);
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * led_blend.c
+ *
+ * This file contains functions for compositing whole RGB565 frames. See
+ * led_blend.h for an overview.
+ *
+ * The NEON variants unpack eight pixels into one uint16x8_t per channel,
+ * do the arithmetic in 16-bit lanes and repack. Products stay below 2^16:
+ * a 6-bit channel times LED_ALPHA_MAX is 16128 and times LED_GAIN_MAX is
+ * 64449. Any pixels left over after the last group of eight go through the
+ * scalar code.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "led_blend.h"
+#include "led_kernels.h"
+
+#define R_MAX 0x1F
+#define G_MAX 0x3F
+#define B_MAX 0x1F
+
+/* Split an RGB565 pixel into its channels and put it back together */
+#define RED(p) ((p) >> 11)
+#define GREEN(p) (((p) >> 5) & G_MAX)
+#define BLUE(p) ((p) & B_MAX)
+#define PACK(r, g, b) ((uint16_t)(((r) << 11) | ((g) << 5) | (b)))
+
+/* Returns <v> limited to <lo>..<hi> */
+static inline int clamp(int v, int lo, int hi) {
+
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* Returns <v> limited to <max> */
+static inline int sat(int v, int max) {
+
+	return v > max ? max : v;
+}
+
+#if defined(LED_KERNELS_HAVE_NEON) && !defined(LED_MATRIX_SCALAR)
+
+struct channels {
+	uint16x8_t r, g, b;
+};
+
+static inline struct channels unpack_neon(const uint16_t *src) {
+
+	uint16x8_t p = vld1q_u16(src);
+	struct channels c = {
+		vshrq_n_u16(p, 11),
+		vandq_u16(vshrq_n_u16(p, 5), vdupq_n_u16(G_MAX)),
+		vandq_u16(p, vdupq_n_u16(B_MAX)),
+	};
+	return c;
+}
+
+static inline void pack_neon(uint16_t *dst, struct channels c) {
+
+	uint16x8_t p = vorrq_u16(vshlq_n_u16(c.r, 11), vshlq_n_u16(c.g, 5));
+	vst1q_u16(dst, vorrq_u16(p, c.b));
+}
+
+/* Returns (<x> * <wx> + <y> * <wy>) / 256 per lane */
+static inline uint16x8_t mix_neon(uint16x8_t x, uint16_t wx, uint16x8_t y,
+				  uint16_t wy) {
+
+	return vshrq_n_u16(vmlaq_n_u16(vmulq_n_u16(x, wx), y, wy), 8);
+}
+
+static size_t blend_neon(uint16_t *dst, const uint16_t *a, const uint16_t *b,
+			 int alpha, size_t n) {
+
+	uint16_t wa = alpha, wb = LED_ALPHA_MAX - alpha;
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		struct channels x = unpack_neon(a + i);
+		struct channels y = unpack_neon(b + i);
+		x.r = mix_neon(x.r, wa, y.r, wb);
+		x.g = mix_neon(x.g, wa, y.g, wb);
+		x.b = mix_neon(x.b, wa, y.b, wb);
+		pack_neon(dst + i, x);
+	}
+	return i;
+}
+
+static size_t add_neon(uint16_t *dst, const uint16_t *a, const uint16_t *b,
+		       size_t n) {
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		struct channels x = unpack_neon(a + i);
+		struct channels y = unpack_neon(b + i);
+		x.r = vminq_u16(vaddq_u16(x.r, y.r), vdupq_n_u16(R_MAX));
+		x.g = vminq_u16(vaddq_u16(x.g, y.g), vdupq_n_u16(G_MAX));
+		x.b = vminq_u16(vaddq_u16(x.b, y.b), vdupq_n_u16(B_MAX));
+		pack_neon(dst + i, x);
+	}
+	return i;
+}
+
+static size_t saturate_neon(uint16_t *dst, const uint16_t *src, int r_gain,
+			    int g_gain, int b_gain, size_t n) {
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		struct channels x = unpack_neon(src + i);
+		x.r = vminq_u16(vshrq_n_u16(vmulq_n_u16(x.r, r_gain), 8),
+				vdupq_n_u16(R_MAX));
+		x.g = vminq_u16(vshrq_n_u16(vmulq_n_u16(x.g, g_gain), 8),
+				vdupq_n_u16(G_MAX));
+		x.b = vminq_u16(vshrq_n_u16(vmulq_n_u16(x.b, b_gain), 8),
+				vdupq_n_u16(B_MAX));
+		pack_neon(dst + i, x);
+	}
+	return i;
+}
+
+#else
+
+/* Without NEON everything is done by the scalar loops */
+#define blend_neon(dst, a, b, alpha, n) ((size_t)0)
+#define add_neon(dst, a, b, n) ((size_t)0)
+#define saturate_neon(dst, src, r_gain, g_gain, b_gain, n) ((size_t)0)
+
+#endif
+
+/*
+ * Blend frame <a> over frame <b> into <dst>. <alpha> is the weight of <a>,
+ * from 0 (only <b>) to LED_ALPHA_MAX (only <a>); it is clamped to that
+ * range.
+ */
+void led_blend(uint16_t *dst, const uint16_t *a, const uint16_t *b,
+	       int alpha, size_t n) {
+
+	alpha = clamp(alpha, 0, LED_ALPHA_MAX);
+	int beta = LED_ALPHA_MAX - alpha;
+	for (size_t i = blend_neon(dst, a, b, alpha, n); i < n; i++) {
+		uint16_t x = a[i], y = b[i];
+		dst[i] = PACK((RED(x) * alpha + RED(y) * beta) >> 8,
+			      (GREEN(x) * alpha + GREEN(y) * beta) >> 8,
+			      (BLUE(x) * alpha + BLUE(y) * beta) >> 8);
+	}
+}
+
+/*
+ * Write step <step> of a cross-fade from frame <from> to frame <to> that
+ * takes <steps> steps into <dst>. Step 0 is <from> and step <steps> is
+ * <to>.
+ */
+void led_crossfade(uint16_t *dst, const uint16_t *from, const uint16_t *to,
+		   int step, int steps, size_t n) {
+
+	int alpha = LED_ALPHA_MAX;
+	if (steps > 0) {
+		alpha = clamp(step, 0, steps) * LED_ALPHA_MAX / steps;
+	}
+	led_blend(dst, to, from, alpha, n);
+}
+
+/*
+ * Add frames <a> and <b> channel by channel into <dst>, saturating each
+ * channel at its maximum so that bright areas clip to white instead of
+ * wrapping around.
+ */
+void led_add(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t n) {
+
+	for (size_t i = add_neon(dst, a, b, n); i < n; i++) {
+		uint16_t x = a[i], y = b[i];
+		dst[i] = PACK(sat(RED(x) + RED(y), R_MAX),
+			      sat(GREEN(x) + GREEN(y), G_MAX),
+			      sat(BLUE(x) + BLUE(y), B_MAX));
+	}
+}
+
+/*
+ * Multiply each channel of frame <src> by its gain, in units of
+ * 1 / LED_GAIN_UNITY, and write the result to <dst>, saturating each
+ * channel at its maximum. Gains are clamped to 0..LED_GAIN_MAX.
+ */
+void led_saturate(uint16_t *dst, const uint16_t *src, int r_gain,
+		  int g_gain, int b_gain, size_t n) {
+
+	r_gain = clamp(r_gain, 0, LED_GAIN_MAX);
+	g_gain = clamp(g_gain, 0, LED_GAIN_MAX);
+	b_gain = clamp(b_gain, 0, LED_GAIN_MAX);
+	for (size_t i = saturate_neon(dst, src, r_gain, g_gain, b_gain, n);
+	     i < n; i++) {
+		uint16_t x = src[i];
+		dst[i] = PACK(sat((RED(x) * r_gain) >> 8, R_MAX),
+			      sat((GREEN(x) * g_gain) >> 8, G_MAX),
+			      sat((BLUE(x) * b_gain) >> 8, B_MAX));
+	}
+}
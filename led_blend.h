@@ -0,0 +1,59 @@
+/*
+ * led_blend.h
+ *
+ * This file contains declarations of functions for compositing whole
+ * RGB565 frames: alpha blending, cross-fading, additive blending and
+ * per-channel gain with saturation.
+ *
+ * Every function works on <n> pixels, usually NUM_LEDS, and <dst> may be
+ * the same buffer as any of the sources. Each channel is handled at its
+ * own RGB565 precision (5, 6 and 5 bits), and the NEON variant, chosen at
+ * compile time like the kernels in led_kernels.h, gives exactly the same
+ * results as the scalar one.
+ */
+
+#ifndef LED_BLEND_H
+#define LED_BLEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Alpha of a frame that fully covers the other one */
+#define LED_ALPHA_MAX 256
+
+/* Gain that leaves a channel unchanged, and the largest gain accepted */
+#define LED_GAIN_UNITY 256
+#define LED_GAIN_MAX 1023
+
+/*
+ * Blend frame <a> over frame <b> into <dst>. <alpha> is the weight of <a>,
+ * from 0 (only <b>) to LED_ALPHA_MAX (only <a>); it is clamped to that
+ * range.
+ */
+void led_blend(uint16_t *dst, const uint16_t *a, const uint16_t *b,
+	       int alpha, size_t n);
+
+/*
+ * Write step <step> of a cross-fade from frame <from> to frame <to> that
+ * takes <steps> steps into <dst>. Step 0 is <from> and step <steps> is
+ * <to>.
+ */
+void led_crossfade(uint16_t *dst, const uint16_t *from, const uint16_t *to,
+		   int step, int steps, size_t n);
+
+/*
+ * Add frames <a> and <b> channel by channel into <dst>, saturating each
+ * channel at its maximum so that bright areas clip to white instead of
+ * wrapping around.
+ */
+void led_add(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t n);
+
+/*
+ * Multiply each channel of frame <src> by its gain, in units of
+ * 1 / LED_GAIN_UNITY, and write the result to <dst>, saturating each
+ * channel at its maximum. Gains are clamped to 0..LED_GAIN_MAX.
+ */
+void led_saturate(uint16_t *dst, const uint16_t *src, int r_gain,
+		  int g_gain, int b_gain, size_t n);
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * led_cache.c
+ *
+ * This file contains functions for a persistent cache of named LED matrix
+ * frames. See led_cache.h for an overview.
+ *
+ * A new cache file is written under a temporary name and renamed into
+ * place, so another program never maps one with a half-written header.
+ * Each entry is a seqlock: a writer makes its sequence odd, changes the
+ * name and pixels and makes it even again, and a reader only accepts the
+ * name and pixels if it saw the same even sequence before and after
+ * copying them. Frames can therefore be stored, replaced and removed
+ * while other programs show them, though only by one writer at a time.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "led_matrix.h"
+#include "led_cache.h"
+
+/* Times a reader retries an entry that is being written */
+#define READ_RETRIES 1000
+
+struct led_cache {
+	struct led_cache_header *header;
+	struct led_cache_entry *entries;
+	size_t size;		/* Of the mapping */
+	int writable;
+};
+
+/* Returns the size of a cache file with <capacity> entries */
+static size_t cache_size(uint32_t capacity) {
+
+	return sizeof(struct led_cache_header) +
+		capacity * sizeof(struct led_cache_entry);
+}
+
+/*
+ * Create an empty cache file <path> with <capacity> entries. The file is
+ * built under a temporary name and linked into place, so if several
+ * processes race to create it, the first one wins and the others leave
+ * its entries alone.
+ *
+ * Returns 0 on success, or if <path> was created meanwhile, and -1 on
+ * error.
+ */
+static int create_cache_file(const char *path, int capacity) {
+
+	struct led_cache_header header;
+	char tmp[PATH_MAX];
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror("Error on call to open()");
+		return -1;
+	}
+
+	/* The entries after the header are zero, i.e. free */
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LED_CACHE_MAGIC, 4);
+	header.version = LED_CACHE_VERSION;
+	header.frame_size = LED_MATRIX_FILESIZE;
+	header.capacity = capacity;
+	if (ftruncate(fd, cache_size(capacity)) == -1 ||
+	    pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+		perror("Error on call to write()");
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	close(fd);
+	if (link(tmp, path) == -1 && errno != EEXIST) {
+		perror("Error on call to link()");
+		unlink(tmp);
+		return -1;
+	}
+	unlink(tmp);
+	return 0;
+}
+
+/*
+ * Map the cache file <path>, or the one named by the environment variable
+ * LED_FRAME_CACHE or else LED_CACHE_PATH if <path> is NULL. A missing file
+ * is created with room for <capacity> frames. A file that cannot be
+ * written is mapped read-only, so led_cache_put() fails but frames can
+ * still be shown.
+ *
+ * Returns a pointer to the cache on success or NULL on error.
+ */
+struct led_cache *led_cache_open(const char *path, int capacity) {
+
+	struct led_cache *cache;
+	struct stat st;
+	int fd, writable = 1;
+
+	if (path == NULL) {
+		path = getenv("LED_FRAME_CACHE");
+		if (path == NULL || *path == '\0') {
+			path = LED_CACHE_PATH;
+		}
+	}
+	if (capacity <= 0) {
+		capacity = LED_CACHE_DEFAULT_CAPACITY;
+	}
+
+	fd = open(path, O_RDWR);
+	if (fd == -1 && errno == ENOENT) {
+		if (create_cache_file(path, capacity) == -1) {
+			return NULL;
+		}
+		fd = open(path, O_RDWR);
+	}
+	if (fd == -1 && errno == EACCES) {
+		writable = 0;
+		fd = open(path, O_RDONLY);
+	}
+	if (fd == -1) {
+		perror("Error on call to open()");
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1) {
+		perror("Error on call to fstat()");
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(struct led_cache_header)) {
+		printf("%s is not a frame cache\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		perror("Error on call to calloc()");
+		close(fd);
+		return NULL;
+	}
+	cache->size = st.st_size;
+	cache->writable = writable;
+	cache->header = mmap(NULL, cache->size, writable ?
+			     PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+			     fd, 0);
+	close(fd);
+	if (cache->header == MAP_FAILED) {
+		perror("Error on call to mmap()");
+		free(cache);
+		return NULL;
+	}
+
+	if (memcmp(cache->header->magic, LED_CACHE_MAGIC, 4) != 0 ||
+	    cache->header->version != LED_CACHE_VERSION ||
+	    cache->header->frame_size != LED_MATRIX_FILESIZE ||
+	    cache_size(cache->header->capacity) > cache->size) {
+		printf("%s is not a supported frame cache\n", path);
+		led_cache_close(cache);
+		return NULL;
+	}
+	cache->entries = (struct led_cache_entry *)(cache->header + 1);
+	return cache;
+}
+
+/* Unmap <cache> and free it. Stored frames stay in the file. */
+void led_cache_close(struct led_cache *cache) {
+
+	if (cache == NULL) {
+		return;
+	}
+	munmap(cache->header, cache->size);
+	free(cache);
+}
+
+/*
+ * Returns the entry of frame <name>, or NULL if there is no such frame.
+ * Only for the writer, which is the only one changing the entries.
+ */
+static struct led_cache_entry *find_entry(const struct led_cache *cache,
+					  const char *name) {
+
+	for (uint32_t i = 0; i < cache->header->capacity; i++) {
+		struct led_cache_entry *e = &cache->entries[i];
+		if (e->name[0] != '\0' &&
+		    strncmp(e->name, name, LED_CACHE_NAME_SIZE) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Copy the pixels of entry <e> into <pixels> if it holds frame <name>.
+ *
+ * Returns 1 if it does, 0 if it does not, and -1 if it was being written
+ * during every attempt.
+ */
+static int read_entry(const struct led_cache_entry *e, const char *name,
+		      uint16_t *pixels) {
+
+	for (int i = 0; i < READ_RETRIES; i++) {
+		unsigned int seq = atomic_load_explicit(&e->seq,
+							memory_order_acquire);
+		int found;
+
+		if (seq & 1) {
+			continue;
+		}
+		found = e->name[0] != '\0' &&
+			strncmp(e->name, name, LED_CACHE_NAME_SIZE) == 0;
+		if (found) {
+			memcpy(pixels, e->pixels, LED_MATRIX_FILESIZE);
+		}
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&e->seq,
+					 memory_order_relaxed) == seq) {
+			return found;
+		}
+	}
+	return -1;
+}
+
+/* Set <e> to frame <name> with <pixels>, or free it if <name> is NULL */
+static void write_entry(struct led_cache_entry *e, const char *name,
+			const uint16_t *pixels) {
+
+	unsigned int seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&e->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memset(e->name, 0, LED_CACHE_NAME_SIZE);
+	if (name != NULL) {
+		memcpy(e->name, name, strlen(name));
+		memcpy(e->pixels, pixels, LED_MATRIX_FILESIZE);
+	}
+	atomic_store_explicit(&e->seq, seq + 2, memory_order_release);
+}
+
+/*
+ * Copy the NUM_LEDS pixels of the frame <name> into <pixels>.
+ *
+ * Returns 0 on success and -1 if there is no such frame, or if it was
+ * being replaced during every attempt to read it.
+ */
+int led_cache_get(const struct led_cache *cache, const char *name,
+		  uint16_t *pixels) {
+
+	for (uint32_t i = 0; i < cache->header->capacity; i++) {
+		if (read_entry(&cache->entries[i], name, pixels) == 1) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Store the NUM_LEDS RGB565 <pixels> as frame <name>, replacing any frame
+ * of that name.
+ *
+ * Returns 0 on success and -1 if the name is too long, the cache is full
+ * or read-only.
+ */
+int led_cache_put(struct led_cache *cache, const char *name,
+		  const uint16_t *pixels) {
+
+	struct led_cache_entry *e;
+	size_t len = strlen(name);
+
+	if (!cache->writable) {
+		printf("Frame cache is read-only\n");
+		return -1;
+	}
+	if (len == 0 || len >= LED_CACHE_NAME_SIZE) {
+		printf("Invalid frame name %s\n", name);
+		return -1;
+	}
+
+	e = find_entry(cache, name);
+	for (uint32_t i = 0; e == NULL && i < cache->header->capacity; i++) {
+		if (cache->entries[i].name[0] == '\0') {
+			e = &cache->entries[i];
+		}
+	}
+	if (e == NULL) {
+		printf("Frame cache is full\n");
+		return -1;
+	}
+	write_entry(e, name, pixels);
+	return 0;
+}
+
+/*
+ * Remove frame <name> from <cache>.
+ *
+ * Returns 0 on success and -1 if there is no such frame.
+ */
+int led_cache_remove(struct led_cache *cache, const char *name) {
+
+	struct led_cache_entry *e;
+
+	if (!cache->writable) {
+		printf("Frame cache is read-only\n");
+		return -1;
+	}
+	e = find_entry(cache, name);
+	if (e == NULL) {
+		return -1;
+	}
+	write_entry(e, NULL, NULL);
+	return 0;
+}
+
+/*
+ * Show frame <name> on <m> and commit it.
+ *
+ * Returns 0 on success and -1 if there is no such frame.
+ */
+int led_cache_show(const struct led_cache *cache, const char *name,
+		   led_matrix_t *m) {
+
+	uint16_t pixels[NUM_LEDS];
+
+	if (led_cache_get(cache, name, pixels) == -1) {
+		return -1;
+	}
+	led_matrix_set_image(m, pixels);
+	led_matrix_commit(m);
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * led_cache.h
+ *
+ * This file contains declarations of functions for a persistent cache of
+ * named, precomputed LED matrix frames, such as boot logos, status icons
+ * or pre-rendered text.
+ *
+ * The cache is a file holding a struct led_cache_header followed by a
+ * fixed number of entries, each a sequence counter, a NUL-padded name and
+ * NUM_LEDS RGB565 pixels, in native byte order. It is mapped into memory
+ * with MAP_SHARED, so frames stored by one program are found by the next
+ * one without any parsing, and showing a cached frame makes no system
+ * calls. Only one program at a time may store or remove frames, but any
+ * number may read them meanwhile.
+ */
+
+#ifndef LED_CACHE_H
+#define LED_CACHE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "led_matrix.h"
+
+/* Used when no path is given and LED_FRAME_CACHE is not set */
+#define LED_CACHE_PATH "/var/tmp/led_matrix.cache"
+
+#define LED_CACHE_MAGIC "LEDC"
+#define LED_CACHE_VERSION 2
+
+/* Longest name, including the terminating NUL */
+#define LED_CACHE_NAME_SIZE 32
+
+/* Number of entries in a new cache file */
+#define LED_CACHE_DEFAULT_CAPACITY 64
+
+struct led_cache_header {
+	char magic[4];		/* LED_CACHE_MAGIC */
+	uint16_t version;	/* LED_CACHE_VERSION */
+	uint16_t frame_size;	/* LED_MATRIX_FILESIZE */
+	uint32_t capacity;	/* Entries in the file */
+	uint32_t reserved;
+};
+
+struct led_cache_entry {
+	atomic_uint seq;		/* Odd while the entry is written */
+	char name[LED_CACHE_NAME_SIZE];	/* Empty for a free entry */
+	uint16_t pixels[NUM_LEDS];
+};
+
+struct led_cache;
+
+/*
+ * Map the cache file <path>, or the one named by the environment variable
+ * LED_FRAME_CACHE or else LED_CACHE_PATH if <path> is NULL. A missing file
+ * is created with room for <capacity> frames. A file that cannot be
+ * written is mapped read-only, so led_cache_put() fails but frames can
+ * still be shown.
+ *
+ * Returns a pointer to the cache on success or NULL on error.
+ */
+struct led_cache *led_cache_open(const char *path, int capacity);
+
+/* Unmap <cache> and free it. Stored frames stay in the file. */
+void led_cache_close(struct led_cache *cache);
+
+/*
+ * Copy the NUM_LEDS pixels of the frame <name> into <pixels>.
+ *
+ * Returns 0 on success and -1 if there is no such frame, or if it was
+ * being replaced during every attempt to read it.
+ */
+int led_cache_get(const struct led_cache *cache, const char *name,
+		  uint16_t *pixels);
+
+/*
+ * Store the NUM_LEDS RGB565 <pixels> as frame <name>, replacing any frame
+ * of that name.
+ *
+ * Returns 0 on success and -1 if the name is too long, the cache is full
+ * or read-only.
+ */
+int led_cache_put(struct led_cache *cache, const char *name,
+		  const uint16_t *pixels);
+
+/*
+ * Remove frame <name> from <cache>.
+ *
+ * Returns 0 on success and -1 if there is no such frame.
+ */
+int led_cache_remove(struct led_cache *cache, const char *name);
+
+/*
+ * Show frame <name> on <m> and commit it.
+ *
+ * Returns 0 on success and -1 if there is no such frame.
+ */
+int led_cache_show(const struct led_cache *cache, const char *name,
+		   led_matrix_t *m);
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * led_canvas.c
+ *
+ * This file contains functions for drawing on a virtual canvas larger than
+ * one LED matrix. See led_canvas.h for an overview.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "led_matrix.h"
+#include "led_canvas.h"
+#include "led_kernels.h"
+
+struct led_canvas {
+	int tiles_x;
+	int tiles_y;
+	uint16_t *pixels;	/* tiles_x * tiles_y tiles, row-major */
+};
+
+/* Returns the address of pixel <x>, <y>, which must be on the canvas */
+static inline uint16_t *pixel_at(const struct led_canvas *canvas, int x,
+				 int y) {
+
+	int tile = (y / TILE_HEIGHT) * canvas->tiles_x + x / TILE_WIDTH;
+	return canvas->pixels + tile * NUM_LEDS +
+		(y % TILE_HEIGHT) * ROW_SIZE + x % TILE_WIDTH;
+}
+
+/*
+ * Create a canvas of <width> x <height> pixels, all RGB565_OFF. The size is
+ * rounded up to a whole number of tiles.
+ *
+ * Returns a pointer to the canvas on success or NULL on error.
+ */
+struct led_canvas *led_canvas_create(int width, int height) {
+
+	struct led_canvas *canvas;
+
+	if (width <= 0 || height <= 0) {
+		printf("Invalid canvas size %dx%d\n", width, height);
+		return NULL;
+	}
+	canvas = malloc(sizeof(*canvas));
+	if (canvas == NULL) {
+		perror("Error on call to malloc()");
+		return NULL;
+	}
+	canvas->tiles_x = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+	canvas->tiles_y = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+	canvas->pixels = calloc((size_t)canvas->tiles_x * canvas->tiles_y,
+				LED_MATRIX_FILESIZE);
+	if (canvas->pixels == NULL) {
+		perror("Error on call to calloc()");
+		free(canvas);
+		return NULL;
+	}
+	return canvas;
+}
+
+/* Free a canvas created with led_canvas_create(). */
+void led_canvas_destroy(struct led_canvas *canvas) {
+
+	free(canvas->pixels);
+	free(canvas);
+}
+
+/* Returns the width of <canvas> in pixels, a multiple of TILE_WIDTH. */
+int led_canvas_width(const struct led_canvas *canvas) {
+
+	return canvas->tiles_x * TILE_WIDTH;
+}
+
+/* Returns the height of <canvas> in pixels, a multiple of TILE_HEIGHT. */
+int led_canvas_height(const struct led_canvas *canvas) {
+
+	return canvas->tiles_y * TILE_HEIGHT;
+}
+
+/* Set the pixel at <x>, <y> to the RGB565 <color>, if it is on the canvas. */
+void led_canvas_set(struct led_canvas *canvas, int x, int y, uint16_t color) {
+
+	if (x < 0 || y < 0 || x >= led_canvas_width(canvas) ||
+	    y >= led_canvas_height(canvas)) {
+		return;
+	}
+	*pixel_at(canvas, x, y) = color;
+}
+
+/* Returns the pixel at <x>, <y>, or RGB565_OFF if it is not on the canvas. */
+uint16_t led_canvas_get(const struct led_canvas *canvas, int x, int y) {
+
+	if (x < 0 || y < 0 || x >= led_canvas_width(canvas) ||
+	    y >= led_canvas_height(canvas)) {
+		return RGB565_OFF;
+	}
+	return *pixel_at(canvas, x, y);
+}
+
+/* Set the whole canvas to the RGB565 <color>. */
+void led_canvas_fill(struct led_canvas *canvas, uint16_t color) {
+
+	fill_pixels(canvas->pixels, color,
+		    canvas->tiles_x * canvas->tiles_y * NUM_LEDS);
+}
+
+/*
+ * Returns the NUM_LEDS pixels of the tile in tile column <tx> and tile row
+ * <ty>, in the same layout as a matrix frame, or NULL if there is no such
+ * tile.
+ */
+uint16_t *led_canvas_tile(struct led_canvas *canvas, int tx, int ty) {
+
+	if (tx < 0 || ty < 0 || tx >= canvas->tiles_x ||
+	    ty >= canvas->tiles_y) {
+		return NULL;
+	}
+	return canvas->pixels + (ty * canvas->tiles_x + tx) * NUM_LEDS;
+}
+
+/*
+ * Show the tiles of <canvas> on the <n> matrices in <matrices>, in row-major
+ * tile order (matrix i shows tile i), and commit them. A NULL entry skips
+ * that tile.
+ */
+void led_canvas_show_tiles(struct led_canvas *canvas,
+			   led_matrix_t **matrices, int n) {
+
+	int num_tiles = canvas->tiles_x * canvas->tiles_y;
+	for (int i = 0; i < n && i < num_tiles; i++) {
+		if (matrices[i] == NULL) {
+			continue;
+		}
+		led_matrix_set_image(matrices[i],
+				     canvas->pixels + i * NUM_LEDS);
+		led_matrix_commit(matrices[i]);
+	}
+}
+
+/*
+ * Show the matrix-sized window of <canvas> with its top left corner at
+ * pixel <x>, <y> on matrix <m>, wrapping around the edges of the canvas,
+ * and commit it. Scrolling is done by moving <x> or <y>.
+ */
+void led_canvas_show_viewport(struct led_canvas *canvas, led_matrix_t *m,
+			      int x, int y) {
+
+	int width = led_canvas_width(canvas);
+	int height = led_canvas_height(canvas);
+	uint16_t frame[NUM_LEDS];
+
+	x = ((x % width) + width) % width;
+	y = ((y % height) + height) % height;
+
+	/* Tile-aligned: the window is exactly one tile */
+	if (x % TILE_WIDTH == 0 && y % TILE_HEIGHT == 0) {
+		led_matrix_set_image(m, pixel_at(canvas, x, y));
+		led_matrix_commit(m);
+		return;
+	}
+
+	/*
+	 * Otherwise each row of the window is the end of a row in one tile
+	 * followed by the start of the same row in the next tile.
+	 */
+	int left = TILE_WIDTH - x % TILE_WIDTH;
+	int x2 = (x + left) % width;
+	for (int r = 0; r < TILE_HEIGHT; r++) {
+		int yr = (y + r) % height;
+		memcpy(frame + r * ROW_SIZE, pixel_at(canvas, x, yr),
+		       left * sizeof(uint16_t));
+		memcpy(frame + r * ROW_SIZE + left, pixel_at(canvas, x2, yr),
+		       (TILE_WIDTH - left) * sizeof(uint16_t));
+	}
+	led_matrix_set_image(m, frame);
+	led_matrix_commit(m);
+}
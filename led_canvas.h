@@ -0,0 +1,76 @@
+/*
+ * led_canvas.h
+ *
+ * This file contains declarations of functions for drawing on a virtual
+ * canvas larger than one LED matrix and showing parts of it on one or
+ * more matrices.
+ *
+ * The canvas is stored as a grid of tiles, each one matrix in size and
+ * laid out exactly like a matrix frame (NUM_LEDS contiguous RGB565
+ * pixels). Showing a whole tile is therefore a straight copy of one frame,
+ * and a viewport at any pixel offset touches at most four tiles.
+ */
+
+#ifndef LED_CANVAS_H
+#define LED_CANVAS_H
+
+#include <stdint.h>
+
+#include "led_matrix.h"
+
+/* Size of one tile in pixels */
+#define TILE_WIDTH ROW_SIZE
+#define TILE_HEIGHT (NUM_LEDS / ROW_SIZE)
+
+struct led_canvas;
+
+/*
+ * Create a canvas of <width> x <height> pixels, all RGB565_OFF. The size is
+ * rounded up to a whole number of tiles.
+ *
+ * Returns a pointer to the canvas on success or NULL on error.
+ */
+struct led_canvas *led_canvas_create(int width, int height);
+
+/* Free a canvas created with led_canvas_create(). */
+void led_canvas_destroy(struct led_canvas *canvas);
+
+/* Returns the width of <canvas> in pixels, a multiple of TILE_WIDTH. */
+int led_canvas_width(const struct led_canvas *canvas);
+
+/* Returns the height of <canvas> in pixels, a multiple of TILE_HEIGHT. */
+int led_canvas_height(const struct led_canvas *canvas);
+
+/* Set the pixel at <x>, <y> to the RGB565 <color>, if it is on the canvas. */
+void led_canvas_set(struct led_canvas *canvas, int x, int y, uint16_t color);
+
+/* Returns the pixel at <x>, <y>, or RGB565_OFF if it is not on the canvas. */
+uint16_t led_canvas_get(const struct led_canvas *canvas, int x, int y);
+
+/* Set the whole canvas to the RGB565 <color>. */
+void led_canvas_fill(struct led_canvas *canvas, uint16_t color);
+
+/*
+ * Returns the NUM_LEDS pixels of the tile in tile column <tx> and tile row
+ * <ty>, in the same layout as a matrix frame, or NULL if there is no such
+ * tile.
+ */
+uint16_t *led_canvas_tile(struct led_canvas *canvas, int tx, int ty);
+
+/*
+ * Show the tiles of <canvas> on the <n> matrices in <matrices>, in row-major
+ * tile order (matrix i shows tile i), and commit them. A NULL entry skips
+ * that tile.
+ */
+void led_canvas_show_tiles(struct led_canvas *canvas,
+			   led_matrix_t **matrices, int n);
+
+/*
+ * Show the matrix-sized window of <canvas> with its top left corner at
+ * pixel <x>, <y> on matrix <m>, wrapping around the edges of the canvas,
+ * and commit it. Scrolling is done by moving <x> or <y>.
+ */
+void led_canvas_show_viewport(struct led_canvas *canvas, led_matrix_t *m,
+			      int x, int y);
+
+#endif
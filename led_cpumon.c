@@ -0,0 +1,113 @@
+/*
+ * led_cpumon.c
+ *
+ * Shows live CPU utilization on the LED matrix: one bar per core, or with
+ * -p one bar per task instead. Samples are taken at a fixed rate with
+ * cpu_monitor_sample(), and at the default 10 Hz the monitor itself uses
+ * a fraction of a percent of one core.
+ *
+ * Run it next to lab3_task2 to see how the children are spread across the
+ * cores, e.g. with both on LED_MATRIX_BACKEND=shm and a viewer, or with
+ * the monitor on the device and lab3_task2 on the memory backend.
+ *
+ * Usage: led_cpumon [-r hz] [-n samples] [-p pid]...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "led_matrix.h"
+#include "led_timer.h"
+#include "cpu_monitor.h"
+
+#define DEFAULT_HZ 10
+
+struct cpumon {
+	struct cpu_monitor *mon;
+	int tasks;		/* Show tasks instead of cores */
+	long samples;		/* Stop after this many, or never if 0 */
+};
+
+/* Sample, draw and commit one frame */
+static int show_frame(void *arg, uint64_t frame) {
+
+	struct cpumon *cm = arg;
+
+	if (cpu_monitor_sample(cm->mon) == -1) {
+		return -1;
+	}
+	if (cm->tasks) {
+		cpu_monitor_show_tasks(cm->mon, led_matrix_default());
+	} else {
+		cpu_monitor_show_cpus(cm->mon, led_matrix_default());
+	}
+	commit_frame();
+	if (cm->samples > 0 && frame + 1 >= (uint64_t)cm->samples) {
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+	struct led_frame_timer timer;
+	struct cpumon cm = {NULL, 0, 0};
+	int hz = DEFAULT_HZ;
+	pid_t pids[CPU_MONITOR_MAX_TASKS];
+	int num_pids = 0;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "r:n:p:")) != -1) {
+		switch (opt) {
+		case 'r':
+			hz = atoi(optarg);
+			break;
+		case 'n':
+			cm.samples = atol(optarg);
+			break;
+		case 'p':
+			if (num_pids == CPU_MONITOR_MAX_TASKS) {
+				printf("At most %d tasks\n",
+				       CPU_MONITOR_MAX_TASKS);
+				return -1;
+			}
+			pids[num_pids++] = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-r hz] [-n samples] [-p pid]...\n",
+			       argv[0]);
+			return -1;
+		}
+	}
+	if (led_frame_timer_init(&timer, hz) == -1) {
+		return -1;
+	}
+
+	cm.mon = cpu_monitor_create();
+	if (cm.mon == NULL) {
+		printf("Failed to open /proc/stat\n");
+		return -1;
+	}
+	for (int i = 0; i < num_pids; i++) {
+		if (cpu_monitor_add_task(cm.mon, pids[i]) == -1) {
+			cpu_monitor_destroy(cm.mon);
+			return -1;
+		}
+	}
+	if (open_led_matrix() == -1) {
+		printf("Failed to initialize LED matrix\n");
+		cpu_monitor_destroy(cm.mon);
+		return -1;
+	}
+
+	cm.tasks = num_pids > 0;
+	ret = led_frame_timer_run(&timer, show_frame, &cm);
+
+	clear_leds();
+	commit_frame();
+	close_led_matrix();
+	cpu_monitor_destroy(cm.mon);
+	return ret == -1 ? -1 : 0;
+}
@@ -0,0 +1,427 @@
+/*
+ * led_event.c
+ *
+ * This file contains an epoll event loop for interactive LED matrix
+ * displays. See led_event.h for an overview.
+ *
+ * Each source lives in a fixed slot whose address is stored in the epoll
+ * event data. A source removed while epoll events are being dispatched is
+ * only marked, and its slot is not reused until the next wait, so a stale
+ * event can never reach a callback registered later.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <linux/input.h>
+
+#include "led_matrix.h"
+#include "led_event.h"
+
+#define MAX_SOURCES (LED_EVENT_MAX_FDS + 2)
+#define MAX_READY 16
+
+enum source_kind {
+	SOURCE_FREE,
+	SOURCE_JOYSTICK,
+	SOURCE_TICK,
+	SOURCE_FD,
+	SOURCE_REMOVED,		/* Free after the current dispatch */
+};
+
+struct source {
+	enum source_kind kind;
+	int fd;
+	void *arg;
+	union {
+		void (*joystick)(void *arg, int key, int value);
+		void (*tick)(void *arg, uint64_t frame);
+		void (*fd)(void *arg, int fd, uint32_t events);
+	} callback;
+};
+
+struct led_event_loop {
+	int epfd;
+	led_matrix_t *matrix;
+	uint64_t frame;		/* Ticks so far */
+	int stopped;
+	struct source sources[MAX_SOURCES];
+};
+
+/*
+ * Returns nonzero if /sys/class/input/<event>/device/name is the name of
+ * the Sense HAT joystick.
+ */
+static int is_joystick(const char *event) {
+
+	char path[PATH_MAX], name[64];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/class/input/%s/device/name", event);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return 0;
+	}
+	len = read(fd, name, sizeof(name) - 1);
+	close(fd);
+	if (len <= 0) {
+		return 0;
+	}
+	name[len] = '\0';
+	name[strcspn(name, "\n")] = '\0';
+	return strcmp(name, LED_JOYSTICK_NAME) == 0;
+}
+
+/*
+ * Open the joystick for non-blocking reads. The environment variable
+ * LED_JOYSTICK_DEVICE overrides the search through /sys/class/input.
+ *
+ * Returns the file descriptor on success and -1 on error.
+ */
+static int open_joystick() {
+
+	char path[PATH_MAX] = "";
+	const char *env;
+	DIR *dir;
+	struct dirent *entry;
+	int fd;
+
+	env = getenv("LED_JOYSTICK_DEVICE");
+	if (env != NULL && *env != '\0') {
+		snprintf(path, sizeof(path), "%s", env);
+	} else if ((dir = opendir("/sys/class/input")) != NULL) {
+		while ((entry = readdir(dir)) != NULL) {
+			if (strncmp(entry->d_name, "event", 5) == 0 &&
+			    is_joystick(entry->d_name)) {
+				snprintf(path, sizeof(path), "/dev/input/%s",
+					 entry->d_name);
+				break;
+			}
+		}
+		closedir(dir);
+	}
+	if (path[0] == '\0') {
+		printf("No %s found\n", LED_JOYSTICK_NAME);
+		return -1;
+	}
+
+	fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1) {
+		perror("Error on call to open()");
+	}
+	return fd;
+}
+
+/*
+ * Take a free slot in <loop> for <fd> and add it to the epoll set.
+ *
+ * Returns a pointer to the slot on success or NULL on error.
+ */
+static struct source *add_source(struct led_event_loop *loop,
+				 enum source_kind kind, int fd,
+				 uint32_t events, void *arg) {
+
+	struct epoll_event ev;
+	struct source *s = NULL;
+
+	for (int i = 0; i < MAX_SOURCES; i++) {
+		if (loop->sources[i].kind == SOURCE_FREE) {
+			s = &loop->sources[i];
+			break;
+		}
+	}
+	if (s == NULL) {
+		printf("Too many event sources\n");
+		return NULL;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = s;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		perror("Error on call to epoll_ctl()");
+		return NULL;
+	}
+	s->kind = kind;
+	s->fd = fd;
+	s->arg = arg;
+	return s;
+}
+
+/* Remove <s> from the epoll set, closing its descriptor if it owns it */
+static void remove_source(struct led_event_loop *loop, struct source *s) {
+
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+	if (s->kind != SOURCE_FD) {
+		close(s->fd);
+	}
+	s->kind = SOURCE_REMOVED;
+	s->fd = -1;
+}
+
+/*
+ * Create an event loop that commits <matrix> after each frame tick, which
+ * may be NULL to commit nothing.
+ *
+ * Returns a pointer to the loop on success or NULL on error.
+ */
+struct led_event_loop *led_event_loop_create(led_matrix_t *matrix) {
+
+	struct led_event_loop *loop = calloc(1, sizeof(*loop));
+	if (loop == NULL) {
+		perror("Error on call to calloc()");
+		return NULL;
+	}
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd == -1) {
+		perror("Error on call to epoll_create1()");
+		free(loop);
+		return NULL;
+	}
+	loop->matrix = matrix;
+	return loop;
+}
+
+/* Close all descriptors owned by <loop> and free it. */
+void led_event_loop_destroy(struct led_event_loop *loop) {
+
+	if (loop == NULL) {
+		return;
+	}
+	for (int i = 0; i < MAX_SOURCES; i++) {
+		struct source *s = &loop->sources[i];
+		if (s->kind == SOURCE_JOYSTICK || s->kind == SOURCE_TICK) {
+			close(s->fd);
+		}
+	}
+	close(loop->epfd);
+	free(loop);
+}
+
+/*
+ * Open the joystick and call <callback>(<arg>, <key>, <value>) for each
+ * key event, where <key> is KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT or
+ * KEY_ENTER from <linux/input.h> and <value> is one of LED_KEY_*. The
+ * environment variable LED_JOYSTICK_DEVICE overrides the search for the
+ * device.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_event_loop_on_joystick(struct led_event_loop *loop,
+			       void (*callback)(void *arg, int key, int value),
+			       void *arg) {
+
+	struct source *s;
+	int fd = open_joystick();
+	if (fd == -1) {
+		return -1;
+	}
+	s = add_source(loop, SOURCE_JOYSTICK, fd, EPOLLIN, arg);
+	if (s == NULL) {
+		close(fd);
+		return -1;
+	}
+	s->callback.joystick = callback;
+	return 0;
+}
+
+/*
+ * Start a frame tick at <hz> ticks per second and call
+ * <callback>(<arg>, <frame>) on each one before the matrix is committed.
+ * <frame> counts ticks including those missed while the loop was busy.
+ * <callback> may be NULL to only commit.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_event_loop_on_tick(struct led_event_loop *loop, int hz,
+			   void (*callback)(void *arg, uint64_t frame),
+			   void *arg) {
+
+	struct itimerspec spec;
+	struct source *s;
+	int fd;
+
+	if (hz <= 0) {
+		printf("Invalid tick rate %d\n", hz);
+		return -1;
+	}
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd == -1) {
+		perror("Error on call to timerfd_create()");
+		return -1;
+	}
+	spec.it_interval.tv_sec = 0;
+	spec.it_interval.tv_nsec = 1000000000L / hz;
+	if (hz == 1) {
+		spec.it_interval.tv_sec = 1;
+		spec.it_interval.tv_nsec = 0;
+	}
+	spec.it_value = spec.it_interval;
+	if (timerfd_settime(fd, 0, &spec, NULL) == -1) {
+		perror("Error on call to timerfd_settime()");
+		close(fd);
+		return -1;
+	}
+	s = add_source(loop, SOURCE_TICK, fd, EPOLLIN, arg);
+	if (s == NULL) {
+		close(fd);
+		return -1;
+	}
+	s->callback.tick = callback;
+	return 0;
+}
+
+/*
+ * Call <callback>(<arg>, <fd>, <events>) whenever <fd> is ready for any of
+ * <events> (EPOLLIN, EPOLLOUT, ...). The loop does not take ownership of
+ * <fd>.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_event_loop_add_fd(struct led_event_loop *loop, int fd,
+			  uint32_t events,
+			  void (*callback)(void *arg, int fd, uint32_t events),
+			  void *arg) {
+
+	struct source *s = add_source(loop, SOURCE_FD, fd, events, arg);
+	if (s == NULL) {
+		return -1;
+	}
+	s->callback.fd = callback;
+	return 0;
+}
+
+/*
+ * Stop watching <fd>. It is safe to call from any callback, including the
+ * one for <fd>.
+ *
+ * Returns 0 on success and -1 if <fd> was not added.
+ */
+int led_event_loop_remove_fd(struct led_event_loop *loop, int fd) {
+
+	for (int i = 0; i < MAX_SOURCES; i++) {
+		struct source *s = &loop->sources[i];
+		if (s->kind == SOURCE_FD && s->fd == fd) {
+			remove_source(loop, s);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Pass every key event waiting on the joystick to its callback */
+static void dispatch_joystick(struct led_event_loop *loop, struct source *s) {
+
+	struct input_event events[MAX_READY];
+	ssize_t len;
+
+	while ((len = read(s->fd, events, sizeof(events))) > 0) {
+		int n = len / sizeof(events[0]);
+		for (int i = 0; i < n; i++) {
+			if (events[i].type == EV_KEY &&
+			    s->kind == SOURCE_JOYSTICK) {
+				s->callback.joystick(s->arg, events[i].code,
+						     events[i].value);
+			}
+		}
+	}
+	if (len == 0) {
+		remove_source(loop, s);
+	} else if (errno != EAGAIN && errno != EINTR) {
+		perror("Error on call to read()");
+		remove_source(loop, s);
+	}
+}
+
+/* Run the tick callback once for all expirations, then commit */
+static void dispatch_tick(struct led_event_loop *loop, struct source *s) {
+
+	uint64_t expirations;
+
+	if (read(s->fd, &expirations, sizeof(expirations)) !=
+	    sizeof(expirations)) {
+		return;
+	}
+	loop->frame += expirations;
+	if (s->callback.tick != NULL) {
+		s->callback.tick(s->arg, loop->frame);
+	}
+	if (loop->matrix != NULL) {
+		led_matrix_commit(loop->matrix);
+	}
+}
+
+/*
+ * Wait up to <timeout_ms> milliseconds, or forever if negative, for
+ * sources to become ready and dispatch them.
+ *
+ * Returns the number of sources dispatched, or -1 on error.
+ */
+int led_event_loop_run_once(struct led_event_loop *loop, int timeout_ms) {
+
+	struct epoll_event ready[MAX_READY];
+	int n;
+
+	for (int i = 0; i < MAX_SOURCES; i++) {
+		if (loop->sources[i].kind == SOURCE_REMOVED) {
+			loop->sources[i].kind = SOURCE_FREE;
+		}
+	}
+
+	n = epoll_wait(loop->epfd, ready, MAX_READY, timeout_ms);
+	if (n == -1) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		perror("Error on call to epoll_wait()");
+		return -1;
+	}
+	for (int i = 0; i < n; i++) {
+		struct source *s = ready[i].data.ptr;
+		switch (s->kind) {
+		case SOURCE_JOYSTICK:
+			dispatch_joystick(loop, s);
+			break;
+		case SOURCE_TICK:
+			dispatch_tick(loop, s);
+			break;
+		case SOURCE_FD:
+			s->callback.fd(s->arg, s->fd, ready[i].events);
+			break;
+		default:
+			break;
+		}
+	}
+	return n;
+}
+
+/*
+ * Dispatch events until led_event_loop_stop() is called from a callback.
+ *
+ * Returns 0 when stopped and -1 on error.
+ */
+int led_event_loop_run(struct led_event_loop *loop) {
+
+	loop->stopped = 0;
+	while (!loop->stopped) {
+		if (led_event_loop_run_once(loop, -1) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Make led_event_loop_run() return after the current dispatch. */
+void led_event_loop_stop(struct led_event_loop *loop) {
+
+	loop->stopped = 1;
+}
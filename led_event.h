@@ -0,0 +1,112 @@
+/*
+ * led_event.h
+ *
+ * This file contains declarations of functions for an event loop that
+ * drives an interactive LED matrix display from a single thread.
+ *
+ * The loop waits on one epoll instance for three kinds of sources:
+ *   - the Sense HAT joystick evdev device, reported key by key,
+ *   - a timerfd frame tick, after which the matrix is committed,
+ *   - any file descriptors added by the caller.
+ * Every callback runs on the thread that calls led_event_loop_run(), which
+ * is also the thread that commits frames, so callbacks can draw on the
+ * matrix without any locking. Nothing is polled: the thread sleeps in
+ * epoll_wait() until one of the sources is ready.
+ */
+
+#ifndef LED_EVENT_H
+#define LED_EVENT_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include "led_matrix.h"
+
+/* Name of the Sense HAT joystick input device */
+#define LED_JOYSTICK_NAME "Raspberry Pi Sense HAT Joystick"
+
+/* Largest number of user file descriptors in one loop */
+#define LED_EVENT_MAX_FDS 32
+
+/* Values passed to a joystick callback, as in struct input_event */
+#define LED_KEY_RELEASED 0
+#define LED_KEY_PRESSED 1
+#define LED_KEY_REPEATED 2
+
+struct led_event_loop;
+
+/*
+ * Create an event loop that commits <matrix> after each frame tick, which
+ * may be NULL to commit nothing.
+ *
+ * Returns a pointer to the loop on success or NULL on error.
+ */
+struct led_event_loop *led_event_loop_create(led_matrix_t *matrix);
+
+/* Close all descriptors owned by <loop> and free it. */
+void led_event_loop_destroy(struct led_event_loop *loop);
+
+/*
+ * Open the joystick and call <callback>(<arg>, <key>, <value>) for each
+ * key event, where <key> is KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT or
+ * KEY_ENTER from <linux/input.h> and <value> is one of LED_KEY_*. The
+ * environment variable LED_JOYSTICK_DEVICE overrides the search for the
+ * device.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_event_loop_on_joystick(struct led_event_loop *loop,
+			       void (*callback)(void *arg, int key, int value),
+			       void *arg);
+
+/*
+ * Start a frame tick at <hz> ticks per second and call
+ * <callback>(<arg>, <frame>) on each one before the matrix is committed.
+ * <frame> counts ticks including those missed while the loop was busy.
+ * <callback> may be NULL to only commit.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_event_loop_on_tick(struct led_event_loop *loop, int hz,
+			   void (*callback)(void *arg, uint64_t frame),
+			   void *arg);
+
+/*
+ * Call <callback>(<arg>, <fd>, <events>) whenever <fd> is ready for any of
+ * <events> (EPOLLIN, EPOLLOUT, ...). The loop does not take ownership of
+ * <fd>.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_event_loop_add_fd(struct led_event_loop *loop, int fd,
+			  uint32_t events,
+			  void (*callback)(void *arg, int fd, uint32_t events),
+			  void *arg);
+
+/*
+ * Stop watching <fd>. It is safe to call from any callback, including the
+ * one for <fd>.
+ *
+ * Returns 0 on success and -1 if <fd> was not added.
+ */
+int led_event_loop_remove_fd(struct led_event_loop *loop, int fd);
+
+/*
+ * Wait up to <timeout_ms> milliseconds, or forever if negative, for
+ * sources to become ready and dispatch them.
+ *
+ * Returns the number of sources dispatched, or -1 on error.
+ */
+int led_event_loop_run_once(struct led_event_loop *loop, int timeout_ms);
+
+/*
+ * Dispatch events until led_event_loop_stop() is called from a callback.
+ *
+ * Returns 0 when stopped and -1 on error.
+ */
+int led_event_loop_run(struct led_event_loop *loop);
+
+/* Make led_event_loop_run() return after the current dispatch. */
+void led_event_loop_stop(struct led_event_loop *loop);
+
+#endif
@@ -0,0 +1,329 @@
+/*
+ * led_export.c
+ *
+ * This file contains functions for mirroring committed LED matrix frames
+ * into a POSIX shared memory ring. See led_export.h for an overview.
+ *
+ * Frame n goes to slot n % capacity. The writer sets the slot sequence to
+ * 2n + 1 while it copies the frame and to 2n + 2 when it is done, then
+ * publishes n + 1 as the frame count. A reader of frame n accepts the copy
+ * only if the sequence was 2n + 2 both before and after copying; anything
+ * else means the slot was reused for a later frame.
+ *
+ * Every shared field is a 32-bit atomic. 64-bit atomics are not lock-free
+ * on 32-bit ARM, where a lock would be private to each process, and even
+ * a 64-bit load there needs write access, which readers do not have. The
+ * frame numbers wrap around, which capacity being a power of 2 makes
+ * harmless, and all comparisons of them are done modulo 2^32.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "led_matrix.h"
+#include "led_export.h"
+
+#define FRAME_WORDS (LED_MATRIX_FILESIZE / sizeof(uint32_t))
+
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2,
+	       "the export ring needs lock-free 32-bit atomics");
+
+struct led_export_header {
+	char magic[4];		/* LED_EXPORT_MAGIC */
+	uint32_t version;	/* LED_EXPORT_VERSION */
+	uint32_t capacity;	/* Slots in the ring */
+	uint32_t frame_size;	/* LED_MATRIX_FILESIZE */
+	atomic_uint count;	/* Frames exported so far, modulo 2^32 */
+};
+
+struct led_export_slot {
+	atomic_uint seq;
+	atomic_uint timestamp_lo;	/* CLOCK_MONOTONIC, in two halves */
+	atomic_uint timestamp_hi;
+	atomic_uint words[FRAME_WORDS];	/* The frame, as 32-bit words */
+};
+
+struct led_export {
+	struct led_export_header *header;
+	struct led_export_slot *slots;
+	size_t size;		/* Of the mapping */
+	char name[NAME_MAX];	/* Set only for the creator */
+	led_matrix_t *matrix;	/* Attached matrix, if any */
+};
+
+/* Returns the size of a ring of <capacity> slots */
+static size_t ring_size(uint32_t capacity) {
+
+	return sizeof(struct led_export_header) +
+		capacity * sizeof(struct led_export_slot);
+}
+
+/* Returns the current CLOCK_MONOTONIC time in nanoseconds */
+static uint64_t now_ns() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Create the shared memory ring <name> (LED_EXPORT_NAME if NULL) with room
+ * for the last <capacity> frames, rounded up to a power of 2, replacing
+ * any ring of that name.
+ *
+ * Returns a pointer to the ring on success or NULL on error.
+ */
+struct led_export *led_export_create(const char *name, int capacity) {
+
+	struct led_export *export;
+	uint32_t slots = 1;
+	void *map;
+	int fd;
+
+	if (capacity <= 0 || capacity > LED_EXPORT_MAX_CAPACITY) {
+		printf("Invalid export capacity %d\n", capacity);
+		return NULL;
+	}
+	while (slots < (uint32_t)capacity) {
+		slots *= 2;
+	}
+	if (name == NULL) {
+		name = LED_EXPORT_NAME;
+	}
+	export = calloc(1, sizeof(*export));
+	if (export == NULL) {
+		perror("Error on call to calloc()");
+		return NULL;
+	}
+	snprintf(export->name, sizeof(export->name), "%s", name);
+	export->size = ring_size(slots);
+
+	/* A new object is zero-filled, so every slot starts unwritten */
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd == -1) {
+		perror("Error on call to shm_open()");
+		free(export);
+		return NULL;
+	}
+	if (ftruncate(fd, export->size) == -1) {
+		perror("Error on call to ftruncate()");
+		close(fd);
+		shm_unlink(name);
+		free(export);
+		return NULL;
+	}
+	map = mmap(NULL, export->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("Error on call to mmap()");
+		shm_unlink(name);
+		free(export);
+		return NULL;
+	}
+
+	export->header = map;
+	export->slots = (struct led_export_slot *)(export->header + 1);
+	export->header->version = LED_EXPORT_VERSION;
+	export->header->capacity = slots;
+	export->header->frame_size = LED_MATRIX_FILESIZE;
+	atomic_thread_fence(memory_order_release);
+	memcpy(export->header->magic, LED_EXPORT_MAGIC, 4);
+	return export;
+}
+
+/*
+ * Map the existing shared memory ring <name> (LED_EXPORT_NAME if NULL)
+ * read-only, to read frames with led_export_read().
+ *
+ * Returns a pointer to the ring on success or NULL on error.
+ */
+struct led_export *led_export_open(const char *name) {
+
+	struct led_export *export;
+	struct led_export_header *header;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (name == NULL) {
+		name = LED_EXPORT_NAME;
+	}
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		perror("Error on call to shm_open()");
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1) {
+		perror("Error on call to fstat()");
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(*header)) {
+		printf("%s is not a frame export ring\n", name);
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("Error on call to mmap()");
+		return NULL;
+	}
+
+	header = map;
+	if (memcmp(header->magic, LED_EXPORT_MAGIC, 4) != 0 ||
+	    header->version != LED_EXPORT_VERSION ||
+	    header->frame_size != LED_MATRIX_FILESIZE ||
+	    header->capacity == 0 ||
+	    (header->capacity & (header->capacity - 1)) != 0 ||
+	    ring_size(header->capacity) > (size_t)st.st_size) {
+		printf("%s is not a frame export ring\n", name);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	export = calloc(1, sizeof(*export));
+	if (export == NULL) {
+		perror("Error on call to calloc()");
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	export->header = header;
+	export->slots = (struct led_export_slot *)(header + 1);
+	export->size = st.st_size;
+	return export;
+}
+
+/*
+ * Unmap <export>. The creator also detaches it from its matrix and
+ * removes the shared memory object.
+ */
+void led_export_close(struct led_export *export) {
+
+	if (export == NULL) {
+		return;
+	}
+	if (export->matrix != NULL) {
+		led_matrix_set_commit_hook(export->matrix, NULL, NULL);
+	}
+	munmap(export->header, export->size);
+	if (export->name[0] != '\0') {
+		shm_unlink(export->name);
+	}
+	free(export);
+}
+
+/* Append the frame of NUM_LEDS RGB565 <pixels> to the ring. */
+void led_export_frame(struct led_export *export, const uint16_t *pixels) {
+
+	uint32_t n = atomic_load_explicit(&export->header->count,
+					  memory_order_relaxed);
+	struct led_export_slot *slot =
+		&export->slots[n & (export->header->capacity - 1)];
+	uint64_t ts = now_ns();
+	uint32_t word;
+
+	atomic_store_explicit(&slot->seq, 2 * n + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&slot->timestamp_lo, (uint32_t)ts,
+			      memory_order_relaxed);
+	atomic_store_explicit(&slot->timestamp_hi, (uint32_t)(ts >> 32),
+			      memory_order_relaxed);
+	for (size_t i = 0; i < FRAME_WORDS; i++) {
+		memcpy(&word, pixels + 2 * i, sizeof(word));
+		atomic_store_explicit(&slot->words[i], word,
+				      memory_order_relaxed);
+	}
+	atomic_store_explicit(&slot->seq, 2 * n + 2, memory_order_release);
+	atomic_store_explicit(&export->header->count, n + 1,
+			      memory_order_release);
+}
+
+/* Commit hook exporting each committed frame */
+static void export_hook(void *arg, const uint16_t *frame) {
+
+	led_export_frame(arg, frame);
+}
+
+/*
+ * Export every frame committed to <m> from now on, until the ring is
+ * closed. Only one ring can be attached to a matrix.
+ */
+void led_export_attach(struct led_export *export, led_matrix_t *m) {
+
+	export->matrix = m;
+	led_matrix_set_commit_hook(m, export_hook, export);
+}
+
+/*
+ * Returns the number of frames exported to the ring so far, modulo 2^32.
+ * The next frame to be exported has this number.
+ */
+uint32_t led_export_count(const struct led_export *export) {
+
+	return atomic_load_explicit(&export->header->count,
+				    memory_order_acquire);
+}
+
+/*
+ * Copy frame number <*cursor> into <pixels> and its timestamp into
+ * <*timestamp_ns> (if not NULL), and advance <*cursor>. A reader usually
+ * starts with <*cursor> at 0, or at led_export_count() for new frames only.
+ *
+ * Returns 1 if a frame was read, 0 if frame <*cursor> has not been
+ * exported yet, or LED_EXPORT_OVERRUN if it has already been overwritten,
+ * in which case <*cursor> is moved to the oldest frame still in the ring.
+ */
+int led_export_read(const struct led_export *export, uint32_t *cursor,
+		    uint16_t *pixels, uint64_t *timestamp_ns) {
+
+	uint32_t capacity = export->header->capacity;
+	uint32_t n = *cursor, count, behind, seq, ts_lo, ts_hi, word;
+	struct led_export_slot *slot = &export->slots[n & (capacity - 1)];
+
+	count = led_export_count(export);
+	behind = count - n;
+	if (behind == 0 || behind > UINT32_MAX / 2) {
+		return 0;
+	}
+	seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	if (behind <= capacity && seq == 2 * n + 2) {
+		ts_lo = atomic_load_explicit(&slot->timestamp_lo,
+					     memory_order_relaxed);
+		ts_hi = atomic_load_explicit(&slot->timestamp_hi,
+					     memory_order_relaxed);
+		for (size_t i = 0; i < FRAME_WORDS; i++) {
+			word = atomic_load_explicit(&slot->words[i],
+						    memory_order_relaxed);
+			memcpy(pixels + 2 * i, &word, sizeof(word));
+		}
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq,
+					 memory_order_relaxed) == seq) {
+			if (timestamp_ns != NULL) {
+				*timestamp_ns = (uint64_t)ts_hi << 32 | ts_lo;
+			}
+			*cursor = n + 1;
+			return 1;
+		}
+	}
+
+	/*
+	 * Frame n was overwritten, or is being overwritten by frame count;
+	 * skip to the oldest one left
+	 */
+	count = led_export_count(export);
+	*cursor = count - n > capacity ? count - capacity : n + 1;
+	return LED_EXPORT_OVERRUN;
+}
@@ -0,0 +1,86 @@
+/*
+ * led_export.h
+ *
+ * This file contains declarations of functions for mirroring committed
+ * LED matrix frames into a POSIX shared memory ring, so that recorders,
+ * previews and tests can watch a matrix without touching its framebuffer.
+ *
+ * The ring is a struct led_export_header followed by <capacity> slots,
+ * each holding one frame and the CLOCK_MONOTONIC time it was committed.
+ * It has a single writer, the process committing the matrix, and any
+ * number of readers in other processes. Every slot has its own sequence
+ * counter, so readers never block the writer and detect a frame that was
+ * overwritten while they were copying it. Exporting a frame makes no
+ * system calls: it is one copy into the mapping and a clock read.
+ */
+
+#ifndef LED_EXPORT_H
+#define LED_EXPORT_H
+
+#include <stdint.h>
+
+#include "led_matrix.h"
+
+#define LED_EXPORT_NAME "/led_matrix_export"
+#define LED_EXPORT_MAGIC "LEDX"
+#define LED_EXPORT_VERSION 2
+
+/* Most frames a ring can hold */
+#define LED_EXPORT_MAX_CAPACITY 65536
+
+/* Result of led_export_read() when frames were overwritten unread */
+#define LED_EXPORT_OVERRUN -2
+
+struct led_export;
+
+/*
+ * Create the shared memory ring <name> (LED_EXPORT_NAME if NULL) with room
+ * for the last <capacity> frames, rounded up to a power of 2, replacing
+ * any ring of that name.
+ *
+ * Returns a pointer to the ring on success or NULL on error.
+ */
+struct led_export *led_export_create(const char *name, int capacity);
+
+/*
+ * Map the existing shared memory ring <name> (LED_EXPORT_NAME if NULL)
+ * read-only, to read frames with led_export_read().
+ *
+ * Returns a pointer to the ring on success or NULL on error.
+ */
+struct led_export *led_export_open(const char *name);
+
+/*
+ * Unmap <export>. The creator also detaches it from its matrix and
+ * removes the shared memory object.
+ */
+void led_export_close(struct led_export *export);
+
+/* Append the frame of NUM_LEDS RGB565 <pixels> to the ring. */
+void led_export_frame(struct led_export *export, const uint16_t *pixels);
+
+/*
+ * Export every frame committed to <m> from now on, until the ring is
+ * closed. Only one ring can be attached to a matrix.
+ */
+void led_export_attach(struct led_export *export, led_matrix_t *m);
+
+/*
+ * Returns the number of frames exported to the ring so far, modulo 2^32.
+ * The next frame to be exported has this number.
+ */
+uint32_t led_export_count(const struct led_export *export);
+
+/*
+ * Copy frame number <*cursor> into <pixels> and its timestamp into
+ * <*timestamp_ns> (if not NULL), and advance <*cursor>. A reader usually
+ * starts with <*cursor> at 0, or at led_export_count() for new frames only.
+ *
+ * Returns 1 if a frame was read, 0 if frame <*cursor> has not been
+ * exported yet, or LED_EXPORT_OVERRUN if it has already been overwritten,
+ * in which case <*cursor> is moved to the oldest frame still in the ring.
+ */
+int led_export_read(const struct led_export *export, uint32_t *cursor,
+		    uint16_t *pixels, uint64_t *timestamp_ns);
+
+#endif
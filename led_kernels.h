@@ -0,0 +1,146 @@
+/*
+ * led_kernels.h
+ *
+ * This file contains the inner loops used to fill and copy blocks of
+ * RGB565 pixels in the LED matrix back buffer.
+ *
+ * Each kernel comes in three variants:
+ *   - scalar: one uint16_t at a time (the original loops),
+ *   - words:  portable 64-bit stores, four pixels each,
+ *   - neon:   128-bit NEON stores, eight pixels each (ARMv7/AArch64 only).
+ * The best variant available is chosen at compile time through the
+ * fill_pixels(), copy_pixels() and pixels_differ() macros. Defining
+ * LED_MATRIX_SCALAR forces the scalar variant.
+ *
+ * The words and neon variants require <n> to be a multiple of 8, which
+ * holds for both a row (ROW_SIZE) and a whole frame (NUM_LEDS).
+ */
+
+#ifndef LED_KERNELS_H
+#define LED_KERNELS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LED_KERNELS_HAVE_NEON 1
+#endif
+
+/* Scalar variants */
+
+static inline void fill_pixels_scalar(uint16_t *dst, uint16_t color, int n) {
+
+	for (int i = 0; i < n; i++) {
+		*(dst + i) = color;
+	}
+}
+
+static inline void copy_pixels_scalar(uint16_t *dst, const uint16_t *src,
+				      int n) {
+
+	for (int i = 0; i < n; i++) {
+		*(dst + i) = src[i];
+	}
+}
+
+static inline int pixels_differ_scalar(const uint16_t *a, const uint16_t *b,
+				       int n) {
+
+	for (int i = 0; i < n; i++) {
+		if (a[i] != b[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * 64-bit word variants. memcpy() of 8 bytes compiles to a single load or
+ * store and avoids any alignment or aliasing assumptions.
+ */
+
+static inline void fill_pixels_words(uint16_t *dst, uint16_t color, int n) {
+
+	uint64_t w = color * UINT64_C(0x0001000100010001);
+	for (int i = 0; i < n; i += 8) {
+		memcpy(dst + i, &w, sizeof(w));
+		memcpy(dst + i + 4, &w, sizeof(w));
+	}
+}
+
+static inline void copy_pixels_words(uint16_t *dst, const uint16_t *src,
+				     int n) {
+
+	uint64_t a, b;
+	for (int i = 0; i < n; i += 8) {
+		memcpy(&a, src + i, sizeof(a));
+		memcpy(&b, src + i + 4, sizeof(b));
+		memcpy(dst + i, &a, sizeof(a));
+		memcpy(dst + i + 4, &b, sizeof(b));
+	}
+}
+
+static inline int pixels_differ_words(const uint16_t *a, const uint16_t *b,
+				      int n) {
+
+	uint64_t x0, x1, y0, y1, diff = 0;
+	for (int i = 0; i < n; i += 8) {
+		memcpy(&x0, a + i, sizeof(x0));
+		memcpy(&x1, a + i + 4, sizeof(x1));
+		memcpy(&y0, b + i, sizeof(y0));
+		memcpy(&y1, b + i + 4, sizeof(y1));
+		diff |= (x0 ^ y0) | (x1 ^ y1);
+	}
+	return diff != 0;
+}
+
+#ifdef LED_KERNELS_HAVE_NEON
+
+/* NEON variants */
+
+static inline void fill_pixels_neon(uint16_t *dst, uint16_t color, int n) {
+
+	uint16x8_t v = vdupq_n_u16(color);
+	for (int i = 0; i < n; i += 8) {
+		vst1q_u16(dst + i, v);
+	}
+}
+
+static inline void copy_pixels_neon(uint16_t *dst, const uint16_t *src,
+				    int n) {
+
+	for (int i = 0; i < n; i += 8) {
+		vst1q_u16(dst + i, vld1q_u16(src + i));
+	}
+}
+
+static inline int pixels_differ_neon(const uint16_t *a, const uint16_t *b,
+				     int n) {
+
+	uint16x8_t diff = vdupq_n_u16(0);
+	for (int i = 0; i < n; i += 8) {
+		diff = vorrq_u16(diff, veorq_u16(vld1q_u16(a + i),
+						 vld1q_u16(b + i)));
+	}
+	uint64x2_t d = vreinterpretq_u64_u16(diff);
+	return (vgetq_lane_u64(d, 0) | vgetq_lane_u64(d, 1)) != 0;
+}
+
+#endif
+
+#if defined(LED_MATRIX_SCALAR)
+#define fill_pixels fill_pixels_scalar
+#define copy_pixels copy_pixels_scalar
+#define pixels_differ pixels_differ_scalar
+#elif defined(LED_KERNELS_HAVE_NEON)
+#define fill_pixels fill_pixels_neon
+#define copy_pixels copy_pixels_neon
+#define pixels_differ pixels_differ_neon
+#else
+#define fill_pixels fill_pixels_words
+#define copy_pixels copy_pixels_words
+#define pixels_differ pixels_differ_words
+#endif
+
+#endif
@@ -16,6 +16,12 @@
  * colors in the more common range 0-255 per channel to the RG565 format.
  * Some RGB565 colors are also predefined in led_matrix.h.
  *
+ * Drawing is done into an off-screen back buffer, which is copied to the
+ * framebuffer by commit_frame().
+ *
+ * led_matrix.o uses the math library, so programs linking it must also be
+ * linked with -lm.
+ *
  * Written by Pontus Ekberg <pontus.ekberg@it.uu.se>
  * Last updated 2018-08-21
  */
@@ -24,31 +30,144 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <linux/fb.h>
 #include <linux/input.h>
 
 #include "led_matrix.h"
+#include "led_kernels.h"
+
+#define NUM_ROWS (NUM_LEDS / ROW_SIZE)
+#define ROW_BYTES (ROW_SIZE * sizeof(uint16_t))
+#define ALL_ROWS ((1u << NUM_ROWS) - 1)
+
+/* The matrix used by the functions that do not take a handle */
+struct led_matrix led_default_matrix;
+
+/*
+ * Brightness LUTs for one level, mapping each RGB565 channel to its dimmed
+ * value, already shifted into place. They are built the first time the
+ * level is set and never change afterwards.
+ */
+struct brightness_lut {
+	int built;
+	int level;
+	uint16_t r[32], g[64], b[32];
+};
+
+/*
+ * Color correction. gamma_lut maps 8-bit channels before conversion to
+ * RGB565. bright_lut points to the brightness LUTs applied when rows are
+ * committed, or is NULL at full brightness, so a commit on another thread
+ * loads it once and uses LUTs that cannot change under it.
+ * correction_generation is increased after bright_lut is published, so
+ * that every matrix commits its rows again.
+ */
+static int gamma_enabled;
+static uint8_t gamma_lut[256];
+static struct brightness_lut bright_luts[LED_BRIGHTNESS_MAX];
+static _Atomic(const struct brightness_lut *) bright_lut;
+static atomic_uint correction_generation;
 
-int fbfd;
-uint16_t *led_map;
+/* Path of the LED matrix framebuffer device, once found */
+static char led_fb_path[PATH_MAX];
+
+/*
+ * Returns nonzero if /sys/class/graphics/<fb>/name is the name of the
+ * Sense HAT framebuffer.
+ */
+static int is_led_fb(const char *fb) {
+
+	char path[PATH_MAX], name[32];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/class/graphics/%s/name", fb);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return 0;
+	}
+	len = read(fd, name, sizeof(name) - 1);
+	close(fd);
+	if (len <= 0) {
+		return 0;
+	}
+	name[len] = '\0';
+	name[strcspn(name, "\n")] = '\0';
+	return strcmp(name, LED_MATRIX_FB_NAME) == 0;
+}
+
+/*
+ * Find the path of the LED matrix framebuffer device. The environment
+ * variable LED_MATRIX_DEVICE overrides the search. Otherwise the names in
+ * /sys/class/graphics/fb* are compared to LED_MATRIX_FB_NAME, which does
+ * not require opening any device, falling back to LED_MATRIX_FILEPATH.
+ * The result is cached until forget_led_fb_path() is called.
+ *
+ * Returns the path.
+ */
+static const char *find_led_fb_path() {
+
+	const char *env;
+	DIR *dir;
+	struct dirent *entry;
+
+	if (led_fb_path[0] != '\0') {
+		return led_fb_path;
+	}
+
+	env = getenv("LED_MATRIX_DEVICE");
+	if (env != NULL && *env != '\0') {
+		snprintf(led_fb_path, sizeof(led_fb_path), "%s", env);
+		return led_fb_path;
+	}
+
+	snprintf(led_fb_path, sizeof(led_fb_path), "%s", LED_MATRIX_FILEPATH);
+	dir = opendir("/sys/class/graphics");
+	if (dir == NULL) {
+		return led_fb_path;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "fb", 2) == 0 &&
+		    is_led_fb(entry->d_name)) {
+			snprintf(led_fb_path, sizeof(led_fb_path), "/dev/%s",
+				 entry->d_name);
+			break;
+		}
+	}
+	closedir(dir);
+	return led_fb_path;
+}
+
+/* Make the next find_led_fb_path() search again */
+static void forget_led_fb_path() {
+
+	led_fb_path[0] = '\0';
+}
 
 /* 
- * Open the LED matrix framebuffer device (which is a special file in /dev).
+ * Open the LED matrix framebuffer device (which is a special file in /dev)
+ * at <path>, or the one found by find_led_fb_path() if <path> is NULL.
  *
  * Returns the file descriptor if successful or -1 on error.
  */
-static int open_led_fb() {
+static int open_led_fb(const char *path) {
 
 	int fbfd;
 	struct fb_fix_screeninfo info;
 	
 	/* Open the LED matrix framebuffer device */
-	fbfd = open(LED_MATRIX_FILEPATH, O_RDWR);
+	fbfd = open(path != NULL ? path : find_led_fb_path(), O_RDWR);
 	if (fbfd == -1) {
 		perror("Error on call to open()");
+		forget_led_fb_path();
 		return -1;
 	}
 
@@ -56,13 +175,15 @@ static int open_led_fb() {
 	if (ioctl(fbfd, FBIOGET_FSCREENINFO, &info) == -1) {
 		perror("Error on call to ioctl()");
 		close(fbfd);
+		forget_led_fb_path();
 		return -1;
 	}
 
 	/* Check that the correct device has been found */
-	if (strcmp(info.id, "RPi-Sense FB") != 0) {
+	if (strcmp(info.id, LED_MATRIX_FB_NAME) != 0) {
 		printf("Wrong device found\n");
 		close(fbfd);
+		forget_led_fb_path();
 		return -1;
 	}
 
@@ -93,51 +214,254 @@ static uint16_t *mmap_led_fb(int fbfd) {
 }
 
 /*
- * Open the LED matrix framebuffer device and map it into memory.
+ * Backend: the real LED matrix framebuffer device, or the framebuffer
+ * device at path <name> if not NULL.
  *
- * !!! This function needs to be called before any of the other functions
- * that perform operations on the LED matrix !!!
+ * Returns 0 on success and -1 on error.
+ */
+static int open_device_backend(led_matrix_t *m, const char *name) {
+
+	m->fbfd = open_led_fb(name);
+	if (m->fbfd == -1) {
+		return -1;
+	}
+
+	m->led_map = mmap_led_fb(m->fbfd);
+	if (m->led_map == NULL) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Backend: anonymous shared memory, visible only to this process and its
+ * children.
  *
  * Returns 0 on success and -1 on error.
  */
-int open_led_matrix() {
+static int open_memory_backend(led_matrix_t *m, const char *name) {
 
-	fbfd = open_led_fb();
-	if (fbfd == -1) {
+	(void)name;
+	m->led_map = mmap(NULL, LED_MATRIX_FILESIZE, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (m->led_map == MAP_FAILED) {
+		perror("Error on call to mmap()");
 		return -1;
 	}
+	m->fbfd = -1;
+	return 0;
+}
+
+/*
+ * Backend: the POSIX shared memory object <name> (LED_MATRIX_SHM_NAME if
+ * NULL), created if needed, so that other processes can map and watch it.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+static int open_shm_backend(led_matrix_t *m, const char *name) {
 
-	led_map = mmap_led_fb(fbfd);
-	if (led_map == NULL) {
+	if (name == NULL) {
+		name = LED_MATRIX_SHM_NAME;
+	}
+	m->fbfd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (m->fbfd == -1) {
+		perror("Error on call to shm_open()");
+		return -1;
+	}
+	if (ftruncate(m->fbfd, LED_MATRIX_FILESIZE) == -1) {
+		perror("Error on call to ftruncate()");
+		close(m->fbfd);
 		return -1;
 	}
 
+	m->led_map = mmap_led_fb(m->fbfd);
+	if (m->led_map == NULL) {
+		return -1;
+	}
 	return 0;
 }
 
+static const struct {
+	const char *name;
+	int (*open)(led_matrix_t *m, const char *name);
+} backends[] = {
+	[LED_BACKEND_DEVICE] = {"device", open_device_backend},
+	[LED_BACKEND_MEMORY] = {"memory", open_memory_backend},
+	[LED_BACKEND_SHM] = {"shm", open_shm_backend},
+};
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
 /*
- * Unmaps the LED matrix framebuffer from memory and closes the
- * framebuffer file descriptor.
+ * Open matrix <m> using <backend> and start its back buffer from whatever
+ * the matrix currently shows. With a brightness applied, what it shows is
+ * dimmed and the drawn colors are not known, so it starts cleared instead.
+ * No row counts as committed until it has been drawn and committed.
  *
- * !!! This function should be called after all functions that perform
- * operations on the LED matrix (only once at the end) !!!
+ * Returns 0 on success and -1 on error.
+ */
+static int open_matrix(led_matrix_t *m, enum led_backend backend,
+		       const char *name) {
+
+	if ((unsigned int)backend >= NUM_BACKENDS) {
+		printf("Unknown LED matrix backend %d\n", backend);
+		return -1;
+	}
+	if (backends[backend].open(m, name) == -1) {
+		return -1;
+	}
+	m->correction = atomic_load_explicit(&correction_generation,
+					     memory_order_acquire);
+	if (atomic_load_explicit(&bright_lut, memory_order_acquire) == NULL) {
+		memcpy(m->back_buffer, m->led_map, LED_MATRIX_FILESIZE);
+	} else {
+		memset(m->back_buffer, 0, LED_MATRIX_FILESIZE);
+	}
+	memcpy(m->front_buffer, m->back_buffer, LED_MATRIX_FILESIZE);
+	m->dirty_rows = 0;
+	m->front_rows = 0;
+	m->commit_hook = NULL;
+	m->commit_arg = NULL;
+	return 0;
+}
+
+/*
+ * Open matrix <m> with the backend selected by the environment variable
+ * LED_MATRIX_BACKEND, or the device backend if it is not set.
  *
  * Returns 0 on success and -1 on error.
  */
-int close_led_matrix() {
+static int open_matrix_from_env(led_matrix_t *m) {
+
+	const char *env = getenv("LED_MATRIX_BACKEND");
+
+	if (env == NULL || *env == '\0') {
+		return open_matrix(m, LED_BACKEND_DEVICE, NULL);
+	}
+	for (unsigned int i = 0; i < NUM_BACKENDS; i++) {
+		size_t len = strlen(backends[i].name);
+		if (strncmp(env, backends[i].name, len) != 0) {
+			continue;
+		}
+		if (env[len] == '\0') {
+			return open_matrix(m, i, NULL);
+		}
+		if (env[len] == ':') {
+			return open_matrix(m, i, env + len + 1);
+		}
+	}
+	printf("Unknown LED matrix backend %s\n", env);
+	return -1;
+}
+
+/*
+ * Unmap the framebuffer of matrix <m> and close its file descriptor.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+static int close_matrix(led_matrix_t *m) {
 
 	int ret = 0;
-	if (munmap(led_map, LED_MATRIX_FILESIZE) == -1) {
+	if (munmap(m->led_map, LED_MATRIX_FILESIZE) == -1) {
 		perror("Error on call to munmap()");
 		ret = -1;
 	}
-	if (close(fbfd) == -1) {
+	if (m->fbfd != -1 && close(m->fbfd) == -1) {
 		perror("Error on call to close()");
 		ret = -1;
 	}
 	return ret;
 }
 
+/*
+ * Open a new LED matrix using <backend>. <name> is the device path for
+ * LED_BACKEND_DEVICE (found automatically if NULL) and the shared memory
+ * object name for LED_BACKEND_SHM (LED_MATRIX_SHM_NAME if NULL).
+ *
+ * Returns a handle for the matrix on success or NULL on error.
+ */
+led_matrix_t *led_matrix_open(enum led_backend backend, const char *name) {
+
+	led_matrix_t *m = malloc(sizeof(*m));
+	if (m == NULL) {
+		perror("Error on call to malloc()");
+		return NULL;
+	}
+	if (open_matrix(m, backend, name) == -1) {
+		free(m);
+		return NULL;
+	}
+	return m;
+}
+
+/*
+ * Close the matrix <m> opened with led_matrix_open() and free the handle.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_matrix_close(led_matrix_t *m) {
+
+	int ret = close_matrix(m);
+	free(m);
+	return ret;
+}
+
+/*
+ * Returns the handle of the matrix used by the functions that do not take
+ * a handle, i.e. the one opened by open_led_matrix().
+ */
+led_matrix_t *led_matrix_default() {
+
+	return &led_default_matrix;
+}
+
+/*
+ * Open the LED matrix using <backend> and map it into memory. <name> is
+ * the shared memory object name for LED_BACKEND_SHM (LED_MATRIX_SHM_NAME
+ * if NULL) and is ignored by the other backends. The shared memory object
+ * is not removed by close_led_matrix(), so watchers can keep reading it.
+ *
+ * Can be used instead of open_led_matrix(), e.g. to run without the
+ * Sense HAT.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int open_led_matrix_backend(enum led_backend backend, const char *name) {
+
+	return open_matrix(&led_default_matrix, backend, name);
+}
+
+/*
+ * Open the LED matrix framebuffer device and map it into memory.
+ *
+ * The device is found by name in /sys/class/graphics, or taken from the
+ * environment variable LED_MATRIX_DEVICE if set, and remembered for later
+ * calls. The environment variable LED_MATRIX_BACKEND can select another
+ * backend: "device" (the default), "memory", "shm" or "shm:<name>".
+ *
+ * !!! This function needs to be called before any of the other functions
+ * that perform operations on the LED matrix !!!
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int open_led_matrix() {
+
+	return open_matrix_from_env(&led_default_matrix);
+}
+
+/*
+ * Unmaps the LED matrix framebuffer from memory and closes the
+ * framebuffer file descriptor.
+ *
+ * !!! This function should be called after all functions that perform
+ * operations on the LED matrix (only once at the end) !!!
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int close_led_matrix() {
+
+	return close_matrix(&led_default_matrix);
+}
+
 /* 
  * Takes r, g, b values in the more common range 0-255 and returns a
  * 16-bit integer encoding the same color (or as close as possible)
@@ -145,6 +469,11 @@ int close_led_matrix() {
  */
 uint16_t make_rgb565_color(int r, int g, int b) {
 	
+	if (gamma_enabled) {
+		r = gamma_lut[r & 0xFF];
+		g = gamma_lut[g & 0xFF];
+		b = gamma_lut[b & 0xFF];
+	}
 	r = (r >> 3) & 0x1F;
 	g = (g >> 2) & 0x3F;
 	b = (b >> 3) & 0x1F;
@@ -152,13 +481,387 @@ uint16_t make_rgb565_color(int r, int g, int b) {
 	return rgb565;
 }
 
+/*
+ * Ordered dithering thresholds, one 8-pixel row per line of a 4x4 Bayer
+ * matrix tiled twice horizontally. Red and blue lose 3 bits (0-7), green
+ * loses 2 bits (0-3).
+ */
+static const uint8_t dither_rb[4][8] = {
+	{0, 4, 1, 5, 0, 4, 1, 5},
+	{6, 2, 7, 3, 6, 2, 7, 3},
+	{1, 5, 0, 4, 1, 5, 0, 4},
+	{7, 3, 6, 2, 7, 3, 6, 2},
+};
+static const uint8_t dither_g[4][8] = {
+	{0, 2, 0, 2, 0, 2, 0, 2},
+	{3, 1, 3, 1, 3, 1, 3, 1},
+	{0, 2, 0, 2, 0, 2, 0, 2},
+	{3, 1, 3, 1, 3, 1, 3, 1},
+};
+
+/* Add <d> to <c>, saturating at 255 */
+static inline int sat_add_u8(int c, int d) {
+
+	c += d;
+	return c > 255 ? 255 : c;
+}
+
+#ifdef LED_KERNELS_HAVE_NEON
+/*
+ * Convert 8 pixels, optionally adding the dither thresholds <drb> and <dg>
+ * (with saturation) first. The channels are packed with shift-right-insert.
+ */
+static inline void convert8_neon(const uint8_t *src, uint16_t *dst,
+				 uint8x8_t drb, uint8x8_t dg) {
+
+	uint8x8x3_t rgb = vld3_u8(src);
+	uint8x8_t r = vqadd_u8(rgb.val[0], drb);
+	uint8x8_t g = vqadd_u8(rgb.val[1], dg);
+	uint8x8_t b = vqadd_u8(rgb.val[2], drb);
+	uint16x8_t out = vshll_n_u8(r, 8);
+	out = vsriq_n_u16(out, vshll_n_u8(g, 8), 5);
+	out = vsriq_n_u16(out, vshll_n_u8(b, 8), 11);
+	vst1q_u16(dst, out);
+}
+#endif
+
+/*
+ * Convert <n> packed RGB888 pixels (3 bytes each, in r, g, b order) from
+ * <src> to RGB565 in <dst>, giving the same result as calling
+ * make_rgb565_color() on each pixel.
+ */
+void convert_rgb888_to_rgb565(const uint8_t *src, uint16_t *dst, size_t n) {
+
+	size_t i = 0;
+
+	if (gamma_enabled) {
+		for (; i < n; i++) {
+			const uint8_t *p = src + 3 * i;
+			dst[i] = RGB565(gamma_lut[p[0]], gamma_lut[p[1]],
+					gamma_lut[p[2]]);
+		}
+		return;
+	}
+#ifdef LED_KERNELS_HAVE_NEON
+	uint8x8_t zero = vdup_n_u8(0);
+	for (; i + 8 <= n; i += 8) {
+		convert8_neon(src + 3 * i, dst + i, zero, zero);
+	}
+#endif
+	for (; i < n; i++) {
+		const uint8_t *p = src + 3 * i;
+		dst[i] = RGB565(p[0], p[1], p[2]);
+	}
+}
+
+/*
+ * Like convert_rgb888_to_rgb565(), but applies ordered (Bayer) dithering
+ * to hide the banding from the lost low bits. Pixel i is assumed to be at
+ * row i / ROW_SIZE and column i % ROW_SIZE.
+ */
+void convert_rgb888_to_rgb565_dither(const uint8_t *src, uint16_t *dst,
+				     size_t n) {
+
+	size_t i = 0;
+#ifdef LED_KERNELS_HAVE_NEON
+	for (; !gamma_enabled && i + 8 <= n; i += 8) {
+		int y = (i / ROW_SIZE) & 3;
+		convert8_neon(src + 3 * i, dst + i, vld1_u8(dither_rb[y]),
+			      vld1_u8(dither_g[y]));
+	}
+#endif
+	for (; i < n; i++) {
+		const uint8_t *p = src + 3 * i;
+		int x = i % ROW_SIZE;
+		int y = (i / ROW_SIZE) & 3;
+		int r = p[0], g = p[1], b = p[2];
+		if (gamma_enabled) {
+			r = gamma_lut[r];
+			g = gamma_lut[g];
+			b = gamma_lut[b];
+		}
+		dst[i] = RGB565(sat_add_u8(r, dither_rb[y][x]),
+				sat_add_u8(g, dither_g[y][x]),
+				sat_add_u8(b, dither_rb[y][x]));
+	}
+}
+
+/*
+ * Set the gamma applied to 8-bit channels by make_rgb565_color() and the
+ * convert_rgb888_to_rgb565*() functions. A <gamma> of 1.0 turns it off.
+ * The RGB565() macro and predefined colors are never corrected.
+ *
+ * Returns 0 on success and -1 if <gamma> is not positive.
+ */
+int led_set_gamma(double gamma) {
+
+	if (!(gamma > 0)) {
+		printf("Invalid gamma %f\n", gamma);
+		return -1;
+	}
+	gamma_enabled = gamma != 1.0;
+	for (int i = 0; i < 256; i++) {
+		gamma_lut[i] = (uint8_t)(pow(i / 255.0, gamma) * 255.0 + 0.5);
+	}
+	return 0;
+}
+
+/* Returns channel value <c> scaled by <level> / LED_BRIGHTNESS_MAX */
+static int scale_channel(int c, int level) {
+
+	return (c * level + LED_BRIGHTNESS_MAX / 2) / LED_BRIGHTNESS_MAX;
+}
+
+/*
+ * Set the global brightness, from 0 (off) to LED_BRIGHTNESS_MAX (full).
+ * It is applied to every pixel as it is committed, so the back buffers
+ * keep their colors and fading is just a series of calls to this
+ * function. The rows each matrix has committed are written again on its
+ * next commit; rows it has never drawn are left alone. It may be called
+ * while another thread commits, e.g. the render thread, but not from
+ * several threads at once.
+ */
+void led_set_brightness(int level) {
+
+	struct brightness_lut *lut = NULL;
+
+	if (level < 0) {
+		level = 0;
+	}
+	if (level > LED_BRIGHTNESS_MAX) {
+		level = LED_BRIGHTNESS_MAX;
+	}
+	if (level < LED_BRIGHTNESS_MAX) {
+		lut = &bright_luts[level];
+	}
+	if (lut != NULL && !lut->built) {
+		for (int c = 0; c < 32; c++) {
+			int v = scale_channel(c, level);
+			lut->r[c] = v << 11;
+			lut->b[c] = v;
+		}
+		for (int c = 0; c < 64; c++) {
+			lut->g[c] = scale_channel(c, level) << 5;
+		}
+		lut->level = level;
+		lut->built = 1;
+	}
+	/* A commit that loads <lut> also sees what was written to it */
+	atomic_store_explicit(&bright_lut, lut, memory_order_release);
+	atomic_fetch_add_explicit(&correction_generation, 1,
+				  memory_order_release);
+}
+
+/* Returns the current global brightness. */
+int led_get_brightness() {
+
+	const struct brightness_lut *lut;
+
+	lut = atomic_load_explicit(&bright_lut, memory_order_acquire);
+	return lut != NULL ? lut->level : LED_BRIGHTNESS_MAX;
+}
+
+/*
+ * Copy <n> pixels to the framebuffer, applying the brightness LUTs <lut>,
+ * or none if NULL
+ */
+static void commit_pixels(uint16_t *dst, const uint16_t *src, int n,
+			  const struct brightness_lut *lut) {
+
+	if (lut == NULL) {
+		memcpy(dst, src, n * sizeof(uint16_t));
+		return;
+	}
+	for (int i = 0; i < n; i++) {
+		uint16_t p = src[i];
+		dst[i] = lut->r[p >> 11] | lut->g[(p >> 5) & 0x3F] |
+			lut->b[p & 0x1F];
+	}
+}
+
+/* Set the whole matrix <m> to a single RGB565 <color>. */
+void led_matrix_fill(led_matrix_t *m, uint16_t color) {
+
+	fill_pixels(m->back_buffer, color, NUM_LEDS);
+	m->dirty_rows = ALL_ROWS;
+}
+
+/*
+ * Set the whole matrix <m> according to the array <image> of NUM_LEDS
+ * RGB565 colors. Only rows that differ from the back buffer, or that have
+ * not been committed yet, are marked for commit.
+ */
+void led_matrix_set_image(led_matrix_t *m, const uint16_t *image) {
+
+	for (int r = 0; r < NUM_ROWS; r++) {
+		uint16_t *p = m->back_buffer + r * ROW_SIZE;
+		const uint16_t *q = image + r * ROW_SIZE;
+		if (!(m->front_rows & (1u << r)) ||
+		    pixels_differ(p, q, ROW_SIZE)) {
+			copy_pixels(p, q, ROW_SIZE);
+			m->dirty_rows |= 1u << r;
+		}
+	}
+}
+
+/*
+ * Set row <row> of <m> to the ROW_SIZE RGB565 colors in <pixels>. The row
+ * is only marked for commit if it differs from the back buffer or has not
+ * been committed yet.
+ */
+void led_matrix_set_row(led_matrix_t *m, int row, const uint16_t *pixels) {
+
+	uint16_t *p;
+
+	if (row < 0 || row >= NUM_ROWS) {
+		printf("Row %d does not exist!\n", row);
+		return;
+	}
+	p = m->back_buffer + row * ROW_SIZE;
+	if (!(m->front_rows & (1u << row)) ||
+	    pixels_differ(p, pixels, ROW_SIZE)) {
+		copy_pixels(p, pixels, ROW_SIZE);
+		m->dirty_rows |= 1u << row;
+	}
+}
+
+/*
+ * Set the single LED at <row> and <col> of <m> to the RGB565 <color>.
+ *
+ * Returns 0 on success and -1 if the LED does not exist.
+ */
+int led_matrix_set_led(led_matrix_t *m, int row, int col, uint16_t color) {
+
+	if (!led_exists(row, col)) {
+		return -1;
+	}
+	led_matrix_set_led_unchecked(m, row, col, color);
+	return 0;
+}
+
+/*
+ * Apply the <n> pixel updates in <ops> to <m>. Without LED_BATCH_SORT in
+ * <flags> they are written in order. With it, they are first collected
+ * into a frame-sized scratch buffer so that only the last update of each
+ * LED is written, in index order. Either way, a later update of the same
+ * LED wins, and updates of LEDs that do not exist are skipped.
+ *
+ * Returns 0 on success and -1 if any update was skipped.
+ */
+int led_matrix_set_leds_batch(led_matrix_t *m, const struct led_op *ops,
+			      size_t n, int flags) {
+
+	_Static_assert(NUM_LEDS <= 64, "one bit per LED in a uint64_t");
+	uint16_t colors[NUM_LEDS];
+	uint64_t touched = 0;
+	unsigned int dirty = 0;
+	int ret = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		unsigned int led_num = ops[i].index;
+		if (led_num >= NUM_LEDS) {
+			ret = -1;
+			continue;
+		}
+		if (flags & LED_BATCH_SORT) {
+			colors[led_num] = ops[i].color;
+			touched |= UINT64_C(1) << led_num;
+		} else {
+			m->back_buffer[led_num] = ops[i].color;
+			dirty |= 1u << (led_num / ROW_SIZE);
+		}
+	}
+	while (touched != 0) {
+		int led_num = __builtin_ctzll(touched);
+		m->back_buffer[led_num] = colors[led_num];
+		dirty |= 1u << (led_num / ROW_SIZE);
+		touched &= touched - 1;
+	}
+	m->dirty_rows |= dirty;
+	return ret;
+}
+
+/*
+ * Copy the rows of the back buffer of <m> that have changed since the
+ * last commit to its framebuffer. A fully dirty frame is copied in one
+ * pass. Rows that are marked but equal to what was last committed are
+ * skipped, so redrawing an unchanged frame writes nothing.
+ *
+ * Returns the number of rows written, or 0 if there was nothing to commit.
+ */
+int led_matrix_commit(led_matrix_t *m) {
+
+	const struct brightness_lut *lut;
+	unsigned int generation, changed = 0;
+	int rows = 0;
+
+	/* Load the generation first, so <lut> is at least as new as it */
+	generation = atomic_load_explicit(&correction_generation,
+					  memory_order_acquire);
+	lut = atomic_load_explicit(&bright_lut, memory_order_acquire);
+
+	/* A new brightness changes every pixel this matrix has committed */
+	if (m->correction != generation) {
+		m->correction = generation;
+		changed = m->front_rows;
+	}
+	if (m->dirty_rows == 0 && changed == 0) {
+		return 0;
+	}
+	for (int r = 0; r < NUM_ROWS; r++) {
+		if ((m->dirty_rows & (1u << r)) &&
+		    (!(m->front_rows & (1u << r)) ||
+		     pixels_differ(m->back_buffer + r * ROW_SIZE,
+				   m->front_buffer + r * ROW_SIZE, ROW_SIZE))) {
+			changed |= 1u << r;
+		}
+	}
+	m->dirty_rows = 0;
+	if (changed == 0) {
+		return 0;
+	}
+	m->front_rows |= changed;
+	if (changed == ALL_ROWS) {
+		commit_pixels(m->led_map, m->back_buffer, NUM_LEDS, lut);
+		copy_pixels(m->front_buffer, m->back_buffer, NUM_LEDS);
+		rows = NUM_ROWS;
+	} else {
+		for (int r = 0; r < NUM_ROWS; r++) {
+			if (changed & (1u << r)) {
+				commit_pixels(m->led_map + r * ROW_SIZE,
+					      m->back_buffer + r * ROW_SIZE,
+					      ROW_SIZE, lut);
+				copy_pixels(m->front_buffer + r * ROW_SIZE,
+					    m->back_buffer + r * ROW_SIZE,
+					    ROW_SIZE);
+				rows++;
+			}
+		}
+	}
+	if (m->commit_hook != NULL) {
+		m->commit_hook(m->commit_arg, m->back_buffer);
+	}
+	return rows;
+}
+
+/*
+ * Call <hook>(<arg>, <frame>) after every commit of <m> that writes at
+ * least one row, where <frame> is the whole committed frame of NUM_LEDS
+ * RGB565 pixels before brightness is applied. The hook runs on the
+ * committing thread and must not modify <m>. A NULL <hook> removes it.
+ */
+void led_matrix_set_commit_hook(led_matrix_t *m,
+				void (*hook)(void *arg, const uint16_t *frame),
+				void *arg) {
+
+	m->commit_hook = hook;
+	m->commit_arg = arg;
+}
+
 /* Set the whole LED matrix to a single RGB565 <color>. */
 void set_leds_single_color(uint16_t color) {
 	
-	uint16_t *p = led_map;
-	for (int i = 0; i < NUM_LEDS; i++) {
-		*(p + i) = color;
-	}
+	led_matrix_fill(&led_default_matrix, color);
 }
 
 /* Turn off all the LEDs. */
@@ -170,25 +873,57 @@ void clear_leds() {
 /* 
  * Set the whole LED matrix according to the array <image> of RGB565 colors.
  * The array <image> should have exactly NUM_LEDS elements.
+ * Only rows that differ from the back buffer, or that have not been
+ * committed yet, are marked for commit.
  */
 void set_leds_image(uint16_t *image) {
 
-	uint16_t *p = led_map;
-	for (int i = 0; i < NUM_LEDS; i++) {
-		*(p + i) = image[i];
-	}
+	led_matrix_set_image(&led_default_matrix, image);
 }
 
 /*
  * Set the single LED at <row> and <col> to the RGB565 <color>.
+ *
+ * Returns 0 on success and -1 if the LED does not exist.
  */
-void set_led(int row, int col, uint16_t color) {
+int set_led(int row, int col, uint16_t color) {
 
-	int led_num = row * ROW_SIZE + col;
-	if (led_num >= NUM_LEDS) {
-		printf("LED (%d, %d) does not exist!\n", row, col);
-		return;
-	}
-	*(led_map + led_num) = color;
+	return led_matrix_set_led(&led_default_matrix, row, col, color);
+}
+
+/*
+ * Apply the <n> pixel updates in <ops> in order, as if by set_led(), so a
+ * later update of the same LED wins. Updates of LEDs that do not exist
+ * are skipped.
+ *
+ * Returns 0 on success and -1 if any update was skipped.
+ */
+int set_leds_batch(const struct led_op *ops, size_t n) {
+
+	return led_matrix_set_leds_batch(&led_default_matrix, ops, n, 0);
+}
+
+/*
+ * Like set_leds_batch(), but only the last update of each LED is written,
+ * in index order.
+ */
+int set_leds_batch_sorted(const struct led_op *ops, size_t n) {
+
+	return led_matrix_set_leds_batch(&led_default_matrix, ops, n,
+					 LED_BATCH_SORT);
 }
 
+/*
+ * Copy the rows of the back buffer that have changed since the last commit
+ * to the LED matrix framebuffer. A fully dirty frame is copied in one pass.
+ * Rows that are marked but equal to what was last committed are skipped,
+ * so redrawing an unchanged frame writes nothing. Rows that have not been
+ * drawn are never written, so processes forked after open_led_matrix()
+ * that each draw their own rows do not erase each other's.
+ *
+ * Returns the number of rows written, or 0 if there was nothing to commit.
+ */
+int commit_frame() {
+
+	return led_matrix_commit(&led_default_matrix);
+}
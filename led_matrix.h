@@ -16,32 +16,76 @@
  * colors in the more common range 0-255 per channel to the RG565 format.
  * Some RGB565 colors are also predefined here.
  *
+ * The drawing functions below only update an off-screen back buffer.
+ * Call commit_frame() to make the changes visible on the LED matrix.
+ *
+ * Those functions work on a single default matrix. To drive several
+ * matrices from one process, open each with led_matrix_open() and use the
+ * led_matrix_*() functions that take the returned handle.
+ *
+ * led_matrix.o uses the math library, so programs linking it must also be
+ * linked with -lm.
+ *
  * Written by Pontus Ekberg <pontus.ekberg@it.uu.se>
  * Last updated 2018-08-21
  */
 
+#ifndef LED_MATRIX_H
+#define LED_MATRIX_H
+
 #include <stdint.h>
+#include <stddef.h>
 
 #define LED_MATRIX_FILEPATH "/dev/fb1"
+#define LED_MATRIX_FB_NAME "RPi-Sense FB"
 #define NUM_LEDS 64
 #define ROW_SIZE 8
 #define COL_SIZE 8
 #define LED_MATRIX_FILESIZE (NUM_LEDS * sizeof(uint16_t))
+#define LED_MATRIX_SHM_NAME "/led_matrix"
+#define LED_BRIGHTNESS_MAX 255
+
+/* Where the LED matrix framebuffer lives, see open_led_matrix_backend() */
+enum led_backend {
+	LED_BACKEND_DEVICE,	/* The real framebuffer device */
+	LED_BACKEND_MEMORY,	/* Anonymous memory, shared with children */
+	LED_BACKEND_SHM,	/* POSIX shared memory, for other processes */
+};
+
+/* One pixel update for set_leds_batch() */
+struct led_op {
+	uint16_t index;		/* row * ROW_SIZE + col */
+	uint16_t color;		/* RGB565 */
+};
 
-/* These are computed using make_rgb565_color() */
-#define RGB565_OFF 	0x0000
-#define RGB565_WHITE 	0xFFFF
-#define RGB565_RED 	0xF800
-#define RGB565_GREEN 	0x07E0
-#define RGB565_BLUE 	0x001F
-#define RGB565_CYAN 	0x07FF
-#define RGB565_MAGENTA 	0xF81F
-#define RGB565_YELLOW 	0xFFE0
+/* Flags for led_matrix_set_leds_batch() */
+#define LED_BATCH_SORT 0x1	/* Write each LED once, in index order */
+
+/*
+ * Compile-time version of make_rgb565_color() for r, g, b constants in the
+ * range 0-255. The result is an integer constant expression.
+ */
+#define RGB565(r, g, b) \
+	((((r) & 0xF8) << 8) | (((g) & 0xFC) << 3) | (((b) & 0xFF) >> 3))
+
+#define RGB565_OFF 	RGB565(0, 0, 0)
+#define RGB565_WHITE 	RGB565(255, 255, 255)
+#define RGB565_RED 	RGB565(255, 0, 0)
+#define RGB565_GREEN 	RGB565(0, 255, 0)
+#define RGB565_BLUE 	RGB565(0, 0, 255)
+#define RGB565_CYAN 	RGB565(0, 255, 255)
+#define RGB565_MAGENTA 	RGB565(255, 0, 255)
+#define RGB565_YELLOW 	RGB565(255, 255, 0)
 
 
 /*
  * Open the LED matrix framebuffer device and map it into memory.
  *
+ * The device is found by name in /sys/class/graphics, or taken from the
+ * environment variable LED_MATRIX_DEVICE if set, and remembered for later
+ * calls. The environment variable LED_MATRIX_BACKEND can select another
+ * backend: "device" (the default), "memory", "shm" or "shm:<name>".
+ *
  * !!! This function needs to be called before any of the other functions
  * that perform operations on the LED matrix !!!
  *
@@ -49,6 +93,19 @@
  */
 int open_led_matrix();
 
+/*
+ * Open the LED matrix using <backend> and map it into memory. <name> is
+ * the shared memory object name for LED_BACKEND_SHM (LED_MATRIX_SHM_NAME
+ * if NULL) and is ignored by the other backends. The shared memory object
+ * is not removed by close_led_matrix(), so watchers can keep reading it.
+ *
+ * Can be used instead of open_led_matrix(), e.g. to run without the
+ * Sense HAT.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int open_led_matrix_backend(enum led_backend backend, const char *name);
+
 /*
  * Unmaps the LED matrix framebuffer from memory and closes the
  * framebuffer file descriptor.
@@ -67,6 +124,44 @@ int close_led_matrix();
  */
 uint16_t make_rgb565_color(int r, int g, int b);
 
+/*
+ * Convert <n> packed RGB888 pixels (3 bytes each, in r, g, b order) from
+ * <src> to RGB565 in <dst>, giving the same result as calling
+ * make_rgb565_color() on each pixel.
+ */
+void convert_rgb888_to_rgb565(const uint8_t *src, uint16_t *dst, size_t n);
+
+/*
+ * Like convert_rgb888_to_rgb565(), but applies ordered (Bayer) dithering
+ * to hide the banding from the lost low bits. Pixel i is assumed to be at
+ * row i / ROW_SIZE and column i % ROW_SIZE.
+ */
+void convert_rgb888_to_rgb565_dither(const uint8_t *src, uint16_t *dst,
+				     size_t n);
+
+/*
+ * Set the gamma applied to 8-bit channels by make_rgb565_color() and the
+ * convert_rgb888_to_rgb565*() functions. A <gamma> of 1.0 turns it off.
+ * The RGB565() macro and predefined colors are never corrected.
+ *
+ * Returns 0 on success and -1 if <gamma> is not positive.
+ */
+int led_set_gamma(double gamma);
+
+/*
+ * Set the global brightness, from 0 (off) to LED_BRIGHTNESS_MAX (full).
+ * It is applied to every pixel as it is committed, so the back buffers
+ * keep their colors and fading is just a series of calls to this
+ * function. The rows each matrix has committed are written again on its
+ * next commit; rows it has never drawn are left alone. It may be called
+ * while another thread commits, e.g. the render thread, but not from
+ * several threads at once.
+ */
+void led_set_brightness(int level);
+
+/* Returns the current global brightness. */
+int led_get_brightness();
+
 /* Set the whole LED matrix to a single RGB565 <color>. */
 void set_leds_single_color(uint16_t color);
 
@@ -76,11 +171,181 @@ void clear_leds();
 /* 
  * Set the whole LED matrix according to the array <image> of RGB565 colors.
  * The array <image> should have exactly NUM_LEDS elements.
+ * Only rows that differ from the back buffer, or that have not been
+ * committed yet, are marked for commit.
  */
 void set_leds_image(uint16_t *image);
 
 /*
  * Set the single LED at <row> and <col> to the RGB565 <color>.
+ *
+ * Returns 0 on success and -1 if the LED does not exist.
+ */
+int set_led(int row, int col, uint16_t color);
+
+/*
+ * Apply the <n> pixel updates in <ops> in order, as if by set_led(), so a
+ * later update of the same LED wins. Updates of LEDs that do not exist
+ * are skipped.
+ *
+ * Returns 0 on success and -1 if any update was skipped.
+ */
+int set_leds_batch(const struct led_op *ops, size_t n);
+
+/*
+ * Like set_leds_batch(), but only the last update of each LED is written,
+ * in index order.
+ */
+int set_leds_batch_sorted(const struct led_op *ops, size_t n);
+
+/*
+ * Copy the rows of the back buffer that have changed since the last commit
+ * to the LED matrix framebuffer. A fully dirty frame is copied in one pass.
+ * Rows that are marked but equal to what was last committed are skipped,
+ * so redrawing an unchanged frame writes nothing. Rows that have not been
+ * drawn are never written, so processes forked after open_led_matrix()
+ * that each draw their own rows do not erase each other's.
+ *
+ * Returns the number of rows written, or 0 if there was nothing to commit.
+ */
+int commit_frame();
+
+/*
+ * One LED matrix. All drawing functions write to the off-screen
+ * back_buffer, and nothing reaches led_map until it is committed.
+ * Bit r of dirty_rows is set when row r has changed since the last commit.
+ * front_buffer holds the frame as last committed, before brightness, so
+ * that a commit only writes the rows that really differ from it. Bit r of
+ * front_rows is set once row r has been committed from this matrix, so
+ * that row r of front_buffer is on led_map.
+ *
+ * The fields are private to led_matrix.c and the inline functions below;
+ * the struct is only defined here so that those can be inlined.
+ */
+struct led_matrix {
+	int fbfd;
+	uint16_t *led_map;
+	uint16_t back_buffer[NUM_LEDS];
+	uint16_t front_buffer[NUM_LEDS];
+	unsigned int dirty_rows;
+	unsigned int front_rows;
+	unsigned int correction;	/* Last correction_generation */
+	void (*commit_hook)(void *arg, const uint16_t *frame);
+	void *commit_arg;
+};
+
+/* Handle for one LED matrix */
+typedef struct led_matrix led_matrix_t;
+
+/*
+ * The matrix used by the functions that do not take a handle. Use
+ * led_matrix_default() instead, except in inline functions.
+ */
+extern struct led_matrix led_default_matrix;
+
+/*
+ * Open a new LED matrix using <backend>. <name> is the device path for
+ * LED_BACKEND_DEVICE (found automatically if NULL) and the shared memory
+ * object name for LED_BACKEND_SHM (LED_MATRIX_SHM_NAME if NULL).
+ *
+ * Returns a handle for the matrix on success or NULL on error.
+ */
+led_matrix_t *led_matrix_open(enum led_backend backend, const char *name);
+
+/*
+ * Close the matrix <m> opened with led_matrix_open() and free the handle.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_matrix_close(led_matrix_t *m);
+
+/*
+ * Returns the handle of the matrix used by the functions that do not take
+ * a handle, i.e. the one opened by open_led_matrix().
+ */
+led_matrix_t *led_matrix_default();
+
+/* Set the whole matrix <m> to a single RGB565 <color>. */
+void led_matrix_fill(led_matrix_t *m, uint16_t color);
+
+/*
+ * Set the whole matrix <m> according to the array <image> of NUM_LEDS
+ * RGB565 colors. Only rows that differ from the back buffer, or that have
+ * not been committed yet, are marked for commit.
+ */
+void led_matrix_set_image(led_matrix_t *m, const uint16_t *image);
+
+/*
+ * Set row <row> of <m> to the ROW_SIZE RGB565 colors in <pixels>. The row
+ * is only marked for commit if it differs from the back buffer or has not
+ * been committed yet.
+ */
+void led_matrix_set_row(led_matrix_t *m, int row, const uint16_t *pixels);
+
+/*
+ * Set the single LED at <row> and <col> of <m> to the RGB565 <color>.
+ *
+ * Returns 0 on success and -1 if the LED does not exist.
+ */
+int led_matrix_set_led(led_matrix_t *m, int row, int col, uint16_t color);
+
+/* Returns nonzero if there is an LED at <row> and <col>. */
+static inline int led_exists(int row, int col) {
+
+	return (unsigned int)row < NUM_LEDS / ROW_SIZE &&
+		(unsigned int)col < ROW_SIZE;
+}
+
+/*
+ * Set the single LED at <row> and <col> of <m> to the RGB565 <color>
+ * without checking that it exists, for loops that already guarantee it.
+ */
+static inline void led_matrix_set_led_unchecked(led_matrix_t *m, int row,
+						int col, uint16_t color) {
+
+	m->back_buffer[row * ROW_SIZE + col] = color;
+	m->dirty_rows |= 1u << row;
+}
+
+/*
+ * Set the single LED at <row> and <col> to the RGB565 <color> without
+ * checking that it exists, for loops that already guarantee it.
+ */
+static inline void set_led_unchecked(int row, int col, uint16_t color) {
+
+	led_matrix_set_led_unchecked(&led_default_matrix, row, col, color);
+}
+
+/*
+ * Apply the <n> pixel updates in <ops> to <m>. Without LED_BATCH_SORT in
+ * <flags> they are written in order. With it, they are first collected
+ * into a frame-sized scratch buffer so that only the last update of each
+ * LED is written, in index order. Either way, a later update of the same
+ * LED wins, and updates of LEDs that do not exist are skipped.
+ *
+ * Returns 0 on success and -1 if any update was skipped.
+ */
+int led_matrix_set_leds_batch(led_matrix_t *m, const struct led_op *ops,
+			      size_t n, int flags);
+
+/*
+ * Copy the rows of the back buffer of <m> that have changed since the
+ * last commit to its framebuffer. A fully dirty frame is copied in one
+ * pass. Rows that are marked but equal to what was last committed are
+ * skipped, so redrawing an unchanged frame writes nothing.
+ *
+ * Returns the number of rows written, or 0 if there was nothing to commit.
+ */
+int led_matrix_commit(led_matrix_t *m);
+
+/*
+ * Call <hook>(<arg>, <frame>) after every commit of <m> that writes at
+ * least one row, where <frame> is the whole committed frame of NUM_LEDS
+ * RGB565 pixels before brightness is applied. The hook runs on the
+ * committing thread and must not modify <m>. A NULL <hook> removes it.
  */
-void set_led(int row, int col, uint16_t color);
+void led_matrix_set_commit_hook(led_matrix_t *m,
+				void (*hook)(void *arg, const uint16_t *frame),
+				void *arg);
 
+#endif
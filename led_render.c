@@ -0,0 +1,306 @@
+/*
+ * led_render.c
+ *
+ * This file contains functions for running an optional render thread that
+ * owns the LED matrix framebuffer. See led_render.h for an overview.
+ *
+ * The queue is a bounded ring buffer with a sequence number per slot,
+ * which allows any number of producers and a single consumer (the render
+ * thread) without locks. A producer claims a slot by advancing
+ * <enqueue_pos> with compare-and-swap, fills it in and then publishes it
+ * by updating the slot's sequence number.
+ *
+ * Before going idle the render thread sets <idle> and then checks the
+ * queue once more, while a producer publishes its slot and then checks
+ * <idle>. With sequentially consistent atomics at least one of them sees
+ * the other, so an update is never left in the queue of a sleeping
+ * thread, and producers only take <idle_lock> when there is one to wake.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "led_matrix.h"
+#include "led_render.h"
+#include "led_timer.h"
+
+#define QUEUE_MASK (RENDER_QUEUE_SIZE - 1)
+
+enum render_op_type {
+	OP_SET_LED,
+	OP_SET_IMAGE,
+	OP_FILL,
+};
+
+struct render_op {
+	atomic_size_t seq;
+	enum render_op_type type;
+	int led_num;
+	uint16_t color;
+	uint16_t image[NUM_LEDS];
+};
+
+static struct render_op queue[RENDER_QUEUE_SIZE];
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos;
+
+static pthread_t render_thread;
+static atomic_int running;
+static struct led_frame_timer timer;
+
+static atomic_int idle;
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_wakeup = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Claim a free slot in the queue. The caller fills it in and passes it to
+ * publish_op().
+ *
+ * Returns the slot, or NULL if the queue is full.
+ */
+static struct render_op *claim_op(size_t *pos_out) {
+
+	size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+	for (;;) {
+		struct render_op *op = &queue[pos & QUEUE_MASK];
+		size_t seq = atomic_load_explicit(&op->seq,
+						  memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+				    &enqueue_pos, &pos, pos + 1,
+				    memory_order_relaxed,
+				    memory_order_relaxed)) {
+				*pos_out = pos;
+				return op;
+			}
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(&enqueue_pos,
+						   memory_order_relaxed);
+		}
+	}
+}
+
+/* Wake the render thread if it is idle */
+static void wake_render() {
+
+	if (atomic_load(&idle)) {
+		pthread_mutex_lock(&idle_lock);
+		atomic_store(&idle, 0);
+		pthread_cond_signal(&idle_wakeup);
+		pthread_mutex_unlock(&idle_lock);
+	}
+}
+
+/* Make a slot filled in after claim_op() visible to the render thread */
+static void publish_op(struct render_op *op, size_t pos) {
+
+	atomic_store(&op->seq, pos + 1);
+	wake_render();
+}
+
+/* Returns 1 if no published update is waiting in the queue */
+static int queue_empty() {
+
+	return atomic_load(&queue[dequeue_pos & QUEUE_MASK].seq) !=
+		dequeue_pos + 1;
+}
+
+/*
+ * Apply all queued updates to the back buffer.
+ *
+ * Returns the number of updates applied.
+ */
+static int drain_queue() {
+
+	int n = 0;
+
+	for (;;) {
+		struct render_op *op = &queue[dequeue_pos & QUEUE_MASK];
+		size_t seq = atomic_load_explicit(&op->seq,
+						  memory_order_acquire);
+		if (seq != dequeue_pos + 1) {
+			return n;
+		}
+		switch (op->type) {
+		case OP_SET_LED:
+			set_led(op->led_num / ROW_SIZE, op->led_num % ROW_SIZE,
+				op->color);
+			break;
+		case OP_SET_IMAGE:
+			set_leds_image(op->image);
+			break;
+		case OP_FILL:
+			set_leds_single_color(op->color);
+			break;
+		}
+		atomic_store_explicit(&op->seq,
+				      dequeue_pos + RENDER_QUEUE_SIZE,
+				      memory_order_release);
+		dequeue_pos++;
+		n++;
+	}
+}
+
+/* Sleep until an update is queued or the render thread is stopped */
+static void wait_for_work() {
+
+	pthread_mutex_lock(&idle_lock);
+	atomic_store(&idle, 1);
+	while (atomic_load(&idle) && queue_empty() &&
+	       atomic_load(&running)) {
+		pthread_cond_wait(&idle_wakeup, &idle_lock);
+	}
+	atomic_store(&idle, 0);
+	pthread_mutex_unlock(&idle_lock);
+}
+
+static void *render_main(void *arg) {
+
+	int quiet_frames = 0;
+
+	(void)arg;
+	while (atomic_load(&running)) {
+		led_frame_timer_wait(&timer);
+		int updates = drain_queue();
+		if (commit_frame() > 0 || updates > 0) {
+			quiet_frames = 0;
+		} else if (++quiet_frames == RENDER_IDLE_FRAMES) {
+			/*
+			 * The deadlines missed while idle are skipped by the
+			 * next wait, so the first update is committed at once.
+			 */
+			wait_for_work();
+			quiet_frames = 0;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Start the render thread, committing frames <refresh_hz> times per second.
+ * open_led_matrix() must have been called first.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_render_start(int refresh_hz) {
+
+	if (led_frame_timer_init(&timer, refresh_hz) == -1) {
+		return -1;
+	}
+	for (size_t i = 0; i < RENDER_QUEUE_SIZE; i++) {
+		atomic_init(&queue[i].seq, i);
+	}
+	atomic_init(&enqueue_pos, 0);
+	dequeue_pos = 0;
+	atomic_store(&idle, 0);
+
+	atomic_store(&running, 1);
+	int err = pthread_create(&render_thread, NULL, render_main, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Error on call to pthread_create(): %s\n",
+			strerror(err));
+		atomic_store(&running, 0);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Apply any updates still in the queue, commit a final frame and stop the
+ * render thread.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_render_stop() {
+
+	atomic_store(&running, 0);
+	pthread_mutex_lock(&idle_lock);
+	atomic_store(&idle, 0);
+	pthread_cond_signal(&idle_wakeup);
+	pthread_mutex_unlock(&idle_lock);
+	int err = pthread_join(render_thread, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Error on call to pthread_join(): %s\n",
+			strerror(err));
+		return -1;
+	}
+	drain_queue();
+	commit_frame();
+	return 0;
+}
+
+/*
+ * Queue setting the single LED at <row> and <col> to the RGB565 <color>.
+ *
+ * Returns 0 on success and -1 if the LED does not exist or the queue is
+ * full.
+ */
+int led_render_set_led(int row, int col, uint16_t color) {
+
+	size_t pos;
+	int led_num = row * ROW_SIZE + col;
+	if (led_num < 0 || led_num >= NUM_LEDS) {
+		return -1;
+	}
+	struct render_op *op = claim_op(&pos);
+	if (op == NULL) {
+		return -1;
+	}
+	op->type = OP_SET_LED;
+	op->led_num = led_num;
+	op->color = color;
+	publish_op(op, pos);
+	return 0;
+}
+
+/*
+ * Queue setting the whole LED matrix according to the array <image> of
+ * RGB565 colors, which should have exactly NUM_LEDS elements.
+ *
+ * Returns 0 on success and -1 if the queue is full.
+ */
+int led_render_set_image(const uint16_t *image) {
+
+	size_t pos;
+	struct render_op *op = claim_op(&pos);
+	if (op == NULL) {
+		return -1;
+	}
+	op->type = OP_SET_IMAGE;
+	memcpy(op->image, image, LED_MATRIX_FILESIZE);
+	publish_op(op, pos);
+	return 0;
+}
+
+/*
+ * Queue setting the whole LED matrix to a single RGB565 <color>.
+ *
+ * Returns 0 on success and -1 if the queue is full.
+ */
+int led_render_fill(uint16_t color) {
+
+	size_t pos;
+	struct render_op *op = claim_op(&pos);
+	if (op == NULL) {
+		return -1;
+	}
+	op->type = OP_FILL;
+	op->color = color;
+	publish_op(op, pos);
+	return 0;
+}
+
+/*
+ * Make an idle render thread commit a frame, e.g. after a change that does
+ * not go through the queue, such as a new brightness.
+ */
+void led_render_wake() {
+
+	wake_render();
+}
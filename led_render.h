@@ -0,0 +1,81 @@
+/*
+ * led_render.h
+ *
+ * This file contains declarations of functions for running an optional
+ * render thread that owns the LED matrix framebuffer.
+ *
+ * While the render thread is running, it is the only thread that may call
+ * the drawing functions in led_matrix.h. Other threads instead queue
+ * updates with the led_render_*() functions below, which never wait: they
+ * put the update in a bounded lock-free ring buffer and return at once.
+ * The render thread applies all queued updates to the back buffer at a
+ * fixed refresh rate and commits them as one frame, so a burst of updates
+ * costs a single framebuffer write.
+ *
+ * After RENDER_IDLE_FRAMES frames in a row with no updates and nothing to
+ * commit, the render thread stops waking up at the refresh rate and
+ * sleeps until the next update is queued. Together with commits skipping
+ * rows that are unchanged on the framebuffer, a static display then costs
+ * no wakeups and no writes at all. A producer only takes a lock to wake
+ * the render thread when it is idle.
+ *
+ * Programs using these functions must be linked with -pthread.
+ */
+
+#ifndef LED_RENDER_H
+#define LED_RENDER_H
+
+#include <stdint.h>
+
+/* Number of queued updates the ring buffer can hold (a power of 2) */
+#define RENDER_QUEUE_SIZE 256
+
+/* Frames without changes after which the render thread goes idle */
+#define RENDER_IDLE_FRAMES 8
+
+/*
+ * Start the render thread, committing frames <refresh_hz> times per second.
+ * open_led_matrix() must have been called first.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_render_start(int refresh_hz);
+
+/*
+ * Apply any updates still in the queue, commit a final frame and stop the
+ * render thread.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_render_stop();
+
+/*
+ * Queue setting the single LED at <row> and <col> to the RGB565 <color>.
+ *
+ * Returns 0 on success and -1 if the LED does not exist or the queue is
+ * full.
+ */
+int led_render_set_led(int row, int col, uint16_t color);
+
+/*
+ * Queue setting the whole LED matrix according to the array <image> of
+ * RGB565 colors, which should have exactly NUM_LEDS elements.
+ *
+ * Returns 0 on success and -1 if the queue is full.
+ */
+int led_render_set_image(const uint16_t *image);
+
+/*
+ * Queue setting the whole LED matrix to a single RGB565 <color>.
+ *
+ * Returns 0 on success and -1 if the queue is full.
+ */
+int led_render_fill(uint16_t color);
+
+/*
+ * Make an idle render thread commit a frame, e.g. after a change that does
+ * not go through the queue, such as a new brightness.
+ */
+void led_render_wake();
+
+#endif
@@ -0,0 +1,296 @@
+/*
+ * led_server.c
+ *
+ * This file contains a datagram server that shows received frames on an
+ * LED matrix. See led_server.h for the packet format.
+ *
+ * Each receive slot has room for one byte more than the largest valid
+ * datagram, so an oversized one is recognized by its length. Only the
+ * last raw frame of a batch and the deltas after it are applied, row by
+ * row with led_matrix_set_row(), so unchanged rows are not committed.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <poll.h>
+
+#include "led_matrix.h"
+#include "led_server.h"
+
+#define NUM_ROWS (NUM_LEDS / ROW_SIZE)
+#define ROW_BYTES (ROW_SIZE * sizeof(uint16_t))
+#define SLOT_SIZE (LED_SERVER_PACKET_MAX + 1)
+
+struct led_server {
+	int fd;
+	led_matrix_t *matrix;
+	struct sockaddr_un unix_addr;	/* sun_path is empty for UDP */
+	struct led_server_stats stats;
+	struct mmsghdr msgs[LED_SERVER_BATCH];
+	struct iovec iovs[LED_SERVER_BATCH];
+	uint16_t slots[LED_SERVER_BATCH][(SLOT_SIZE + 1) / 2];
+};
+
+/* Open a UDP socket bound to <port> on all interfaces */
+static int open_udp(struct led_server *server, const char *port) {
+
+	struct sockaddr_in addr;
+	char *end;
+	long p = strtol(port, &end, 10);
+
+	if (*port == '\0' || *end != '\0' || p <= 0 || p > 65535) {
+		printf("Invalid port %s\n", port);
+		return -1;
+	}
+	server->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (server->fd == -1) {
+		perror("Error on call to socket()");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(p);
+	if (bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		perror("Error on call to bind()");
+		close(server->fd);
+		return -1;
+	}
+	return 0;
+}
+
+/* Open a Unix datagram socket bound to <path>, replacing any old socket */
+static int open_unix(struct led_server *server, const char *path) {
+
+	struct sockaddr_un *addr = &server->unix_addr;
+
+	if (*path == '\0' || strlen(path) >= sizeof(addr->sun_path)) {
+		printf("Invalid socket path %s\n", path);
+		return -1;
+	}
+	server->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (server->fd == -1) {
+		perror("Error on call to socket()");
+		return -1;
+	}
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	unlink(path);
+	if (bind(server->fd, (struct sockaddr *)addr, sizeof(*addr)) == -1) {
+		perror("Error on call to bind()");
+		close(server->fd);
+		addr->sun_path[0] = '\0';
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Start a server that shows what it receives on <matrix>. <address> is
+ * "udp:<port>" to listen on all interfaces or "unix:<path>" for a Unix
+ * datagram socket, which is created at <path>. NULL listens on UDP port
+ * LED_SERVER_PORT.
+ *
+ * Returns a pointer to the server on success or NULL on error.
+ */
+struct led_server *led_server_open(const char *address, led_matrix_t *matrix) {
+
+	struct led_server *server;
+	char port[8];
+	int ret;
+
+	server = calloc(1, sizeof(*server));
+	if (server == NULL) {
+		perror("Error on call to calloc()");
+		return NULL;
+	}
+	server->matrix = matrix;
+
+	if (address == NULL) {
+		snprintf(port, sizeof(port), "%d", LED_SERVER_PORT);
+		ret = open_udp(server, port);
+	} else if (strncmp(address, "udp:", 4) == 0) {
+		ret = open_udp(server, address + 4);
+	} else if (strncmp(address, "unix:", 5) == 0) {
+		ret = open_unix(server, address + 5);
+	} else {
+		printf("Unknown server address %s\n", address);
+		ret = -1;
+	}
+	if (ret == -1) {
+		free(server);
+		return NULL;
+	}
+
+	for (int i = 0; i < LED_SERVER_BATCH; i++) {
+		server->iovs[i].iov_base = server->slots[i];
+		server->iovs[i].iov_len = SLOT_SIZE;
+		server->msgs[i].msg_hdr.msg_iov = &server->iovs[i];
+		server->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	return server;
+}
+
+/* Close the socket of <server>, remove its Unix socket file, and free it. */
+void led_server_close(struct led_server *server) {
+
+	if (server == NULL) {
+		return;
+	}
+	close(server->fd);
+	if (server->unix_addr.sun_path[0] != '\0') {
+		unlink(server->unix_addr.sun_path);
+	}
+	free(server);
+}
+
+/*
+ * Returns the file descriptor of the socket of <server>, to wait on it
+ * with poll() or an event loop.
+ */
+int led_server_fd(const struct led_server *server) {
+
+	return server->fd;
+}
+
+/* Returns nonzero if a datagram of <len> bytes is a raw frame */
+static inline int is_frame(unsigned int len) {
+
+	return len == LED_SERVER_FRAME_SIZE;
+}
+
+/* Returns nonzero if <packet> of <len> bytes is a valid delta */
+static inline int is_delta(const uint8_t *packet, unsigned int len) {
+
+	return len >= 1 && len == 1 + __builtin_popcount(packet[0]) * ROW_BYTES;
+}
+
+/* Write the rows of the delta <packet> to the matrix */
+static void apply_delta(struct led_server *server, const uint8_t *packet) {
+
+	uint16_t row[ROW_SIZE];
+	const uint8_t *p = packet + 1;
+
+	for (int r = 0; r < NUM_ROWS; r++) {
+		if (packet[0] & (1u << r)) {
+			memcpy(row, p, ROW_BYTES);
+			led_matrix_set_row(server->matrix, r, row);
+			p += ROW_BYTES;
+		}
+	}
+}
+
+/* Apply the first <n> received datagrams of a batch */
+static int apply_batch(struct led_server *server, int n) {
+
+	int first = 0, applied = 0;
+
+	for (int i = 0; i < n; i++) {
+		if (is_frame(server->msgs[i].msg_len)) {
+			first = i;
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		const uint8_t *packet = (const uint8_t *)server->slots[i];
+		unsigned int len = server->msgs[i].msg_len;
+		int valid = is_frame(len) || is_delta(packet, len);
+
+		server->stats.packets++;
+		if (!valid) {
+			server->stats.dropped++;
+		} else if (i < first) {
+			server->stats.superseded++;
+		} else if (is_frame(len)) {
+			for (int r = 0; r < NUM_ROWS; r++) {
+				const uint16_t *row = server->slots[i] +
+					r * ROW_SIZE;
+				led_matrix_set_row(server->matrix, r, row);
+			}
+			server->stats.frames++;
+			applied++;
+		} else {
+			apply_delta(server, packet);
+			server->stats.deltas++;
+			applied++;
+		}
+	}
+	return applied;
+}
+
+/*
+ * Receive every datagram waiting on <server> without blocking, apply
+ * them to the matrix and commit it.
+ *
+ * Returns the number of datagrams applied, or -1 on error.
+ */
+int led_server_receive(struct led_server *server) {
+
+	int n, applied = 0;
+
+	do {
+		n = recvmmsg(server->fd, server->msgs, LED_SERVER_BATCH,
+			     MSG_DONTWAIT, NULL);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK ||
+			    errno == EINTR) {
+				break;
+			}
+			perror("Error on call to recvmmsg()");
+			return -1;
+		}
+		applied += apply_batch(server, n);
+	} while (n == LED_SERVER_BATCH);
+
+	if (applied > 0) {
+		led_matrix_commit(server->matrix);
+	}
+	return applied;
+}
+
+/*
+ * Callback for led_event_loop_add_fd() that calls led_server_receive() on
+ * the server passed as <arg>.
+ */
+void led_server_dispatch(void *arg, int fd, uint32_t events) {
+
+	(void)fd;
+	(void)events;
+	led_server_receive(arg);
+}
+
+/*
+ * Receive and apply datagrams, blocking while there are none, until an
+ * error occurs.
+ *
+ * Returns -1.
+ */
+int led_server_run(struct led_server *server) {
+
+	struct pollfd pfd = {server->fd, POLLIN, 0};
+
+	for (;;) {
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+			perror("Error on call to poll()");
+			return -1;
+		}
+		if (led_server_receive(server) == -1) {
+			return -1;
+		}
+	}
+}
+
+/* Returns the statistics of <server>. */
+const struct led_server_stats *led_server_stats(
+	const struct led_server *server) {
+
+	return &server->stats;
+}
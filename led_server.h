@@ -0,0 +1,91 @@
+/*
+ * led_server.h
+ *
+ * This file contains declarations of functions for a server that receives
+ * LED matrix frames from other hosts or processes over UDP or a Unix
+ * datagram socket and shows them on a matrix.
+ *
+ * Each datagram is one of:
+ *   - a raw frame: exactly LED_SERVER_FRAME_SIZE bytes, the NUM_LEDS
+ *     RGB565 pixels in native byte order, like the framebuffer,
+ *   - a delta: one byte with bit r set for each changed row r, followed
+ *     by the pixels of those rows in row order, the same layout as delta
+ *     frames in led_anim.h.
+ * Anything else is dropped. Datagrams are received in batches with
+ * recvmmsg(), and within a batch everything before the last raw frame is
+ * superseded and never touches the matrix.
+ */
+
+#ifndef LED_SERVER_H
+#define LED_SERVER_H
+
+#include <stdint.h>
+
+#include "led_matrix.h"
+
+/* Size of a raw frame datagram and of the largest delta datagram */
+#define LED_SERVER_FRAME_SIZE LED_MATRIX_FILESIZE
+#define LED_SERVER_PACKET_MAX (1 + LED_MATRIX_FILESIZE)
+
+/* Default UDP port */
+#define LED_SERVER_PORT 5565
+
+/* Datagrams received per recvmmsg() call */
+#define LED_SERVER_BATCH 16
+
+struct led_server_stats {
+	uint64_t packets;	/* Datagrams received */
+	uint64_t frames;	/* Raw frames applied */
+	uint64_t deltas;	/* Deltas applied */
+	uint64_t superseded;	/* Valid datagrams skipped for a later frame */
+	uint64_t dropped;	/* Invalid datagrams */
+};
+
+struct led_server;
+
+/*
+ * Start a server that shows what it receives on <matrix>. <address> is
+ * "udp:<port>" to listen on all interfaces or "unix:<path>" for a Unix
+ * datagram socket, which is created at <path>. NULL listens on UDP port
+ * LED_SERVER_PORT.
+ *
+ * Returns a pointer to the server on success or NULL on error.
+ */
+struct led_server *led_server_open(const char *address, led_matrix_t *matrix);
+
+/* Close the socket of <server>, remove its Unix socket file, and free it. */
+void led_server_close(struct led_server *server);
+
+/*
+ * Returns the file descriptor of the socket of <server>, to wait on it
+ * with poll() or an event loop.
+ */
+int led_server_fd(const struct led_server *server);
+
+/*
+ * Receive every datagram waiting on <server> without blocking, apply
+ * them to the matrix and commit it.
+ *
+ * Returns the number of datagrams applied, or -1 on error.
+ */
+int led_server_receive(struct led_server *server);
+
+/*
+ * Callback for led_event_loop_add_fd() that calls led_server_receive() on
+ * the server passed as <arg>.
+ */
+void led_server_dispatch(void *arg, int fd, uint32_t events);
+
+/*
+ * Receive and apply datagrams, blocking while there are none, until an
+ * error occurs.
+ *
+ * Returns -1.
+ */
+int led_server_run(struct led_server *server);
+
+/* Returns the statistics of <server>. */
+const struct led_server_stats *led_server_stats(
+	const struct led_server *server);
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * led_shared.c
+ *
+ * This file contains functions for sharing one LED matrix frame between
+ * several processes without locks. See led_shared.h for an overview.
+ *
+ * Writers bump <begin> before and <end> after each update. A reader only
+ * accepts a snapshot if no update was in progress when it started
+ * (begin == end) and none started while it was copying (begin unchanged).
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include "led_matrix.h"
+#include "led_shared.h"
+
+struct led_shared_frame {
+	atomic_uint begin;
+	atomic_uint end;
+	_Atomic uint16_t pixels[NUM_LEDS];
+};
+
+/*
+ * Create a shared frame with all pixels set to RGB565_OFF.
+ *
+ * Returns a pointer to the frame on success or NULL on error.
+ */
+struct led_shared_frame *led_shared_create() {
+
+	struct led_shared_frame *frame;
+
+	/* Anonymous mappings are zero-filled, i.e. RGB565_OFF */
+	frame = mmap(NULL, sizeof(*frame), PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (frame == MAP_FAILED) {
+		perror("Error on call to mmap()");
+		return NULL;
+	}
+	return frame;
+}
+
+/*
+ * Unmap a shared frame created with led_shared_create().
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_shared_destroy(struct led_shared_frame *frame) {
+
+	if (munmap(frame, sizeof(*frame)) == -1) {
+		perror("Error on call to munmap()");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Set the single pixel at <row> and <col> of <frame> to the RGB565 <color>.
+ * Safe to call from any number of processes at the same time.
+ */
+void led_shared_set(struct led_shared_frame *frame, int row, int col,
+		    uint16_t color) {
+
+	int led_num = row * ROW_SIZE + col;
+	if (led_num < 0 || led_num >= NUM_LEDS) {
+		printf("LED (%d, %d) does not exist!\n", row, col);
+		return;
+	}
+	atomic_fetch_add(&frame->begin, 1);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&frame->pixels[led_num], color,
+			      memory_order_relaxed);
+	atomic_fetch_add_explicit(&frame->end, 1, memory_order_release);
+}
+
+/* Set every pixel of <frame> to the RGB565 <color> as one update. */
+void led_shared_fill(struct led_shared_frame *frame, uint16_t color) {
+
+	atomic_fetch_add(&frame->begin, 1);
+	atomic_thread_fence(memory_order_release);
+	for (int i = 0; i < NUM_LEDS; i++) {
+		atomic_store_explicit(&frame->pixels[i], color,
+				      memory_order_relaxed);
+	}
+	atomic_fetch_add_explicit(&frame->end, 1, memory_order_release);
+}
+
+/*
+ * Returns the number of updates completed on <frame> so far. A reader can
+ * compare this to the value returned by its last led_shared_snapshot() to
+ * see whether anything has changed.
+ */
+uint32_t led_shared_generation(struct led_shared_frame *frame) {
+
+	return atomic_load_explicit(&frame->end, memory_order_acquire);
+}
+
+/*
+ * Copy a consistent snapshot of <frame> into the array <image>, which
+ * should have exactly NUM_LEDS elements. Retries while updates are in
+ * progress, so it never blocks writers.
+ *
+ * Returns the generation that the snapshot corresponds to.
+ */
+uint32_t led_shared_snapshot(struct led_shared_frame *frame, uint16_t *image) {
+
+	unsigned int begin, end;
+
+	for (;;) {
+		end = atomic_load_explicit(&frame->end, memory_order_acquire);
+		begin = atomic_load(&frame->begin);
+		if (begin != end) {
+			continue;
+		}
+		for (int i = 0; i < NUM_LEDS; i++) {
+			image[i] = atomic_load_explicit(&frame->pixels[i],
+							memory_order_relaxed);
+		}
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&frame->begin,
+					 memory_order_relaxed) == begin) {
+			return end;
+		}
+	}
+}
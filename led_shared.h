@@ -0,0 +1,66 @@
+/*
+ * led_shared.h
+ *
+ * This file contains declarations of functions for sharing one LED matrix
+ * frame between several processes without locks.
+ *
+ * A shared frame is created in an anonymous MAP_SHARED mapping, so it must
+ * be created before fork() to be inherited by the children. Any number of
+ * processes may then update pixels concurrently with led_shared_set().
+ * Every pixel is its own atomic slot, so pixels are never torn, and a pair
+ * of generation counters (a multi-writer seqlock) lets a reader take a
+ * snapshot of the whole frame that no update is halfway through.
+ *
+ * The usual setup is that the children write to the shared frame and the
+ * parent acts as compositor, copying snapshots to the LED matrix with
+ * set_leds_image() and commit_frame().
+ */
+
+#ifndef LED_SHARED_H
+#define LED_SHARED_H
+
+#include <stdint.h>
+
+struct led_shared_frame;
+
+/*
+ * Create a shared frame with all pixels set to RGB565_OFF.
+ *
+ * Returns a pointer to the frame on success or NULL on error.
+ */
+struct led_shared_frame *led_shared_create();
+
+/*
+ * Unmap a shared frame created with led_shared_create().
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int led_shared_destroy(struct led_shared_frame *frame);
+
+/*
+ * Set the single pixel at <row> and <col> of <frame> to the RGB565 <color>.
+ * Safe to call from any number of processes at the same time.
+ */
+void led_shared_set(struct led_shared_frame *frame, int row, int col,
+		    uint16_t color);
+
+/* Set every pixel of <frame> to the RGB565 <color> as one update. */
+void led_shared_fill(struct led_shared_frame *frame, uint16_t color);
+
+/*
+ * Returns the number of updates completed on <frame> so far. A reader can
+ * compare this to the value returned by its last led_shared_snapshot() to
+ * see whether anything has changed.
+ */
+uint32_t led_shared_generation(struct led_shared_frame *frame);
+
+/*
+ * Copy a consistent snapshot of <frame> into the array <image>, which
+ * should have exactly NUM_LEDS elements. Retries while updates are in
+ * progress, so it never blocks writers.
+ *
+ * Returns the generation that the snapshot corresponds to.
+ */
+uint32_t led_shared_snapshot(struct led_shared_frame *frame, uint16_t *image);
+
+#endif
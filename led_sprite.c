@@ -0,0 +1,255 @@
+/*
+ * led_sprite.c
+ *
+ * This file contains functions for drawing sprites and text into RGB565
+ * pixel buffers. See led_sprite.h for an overview.
+ *
+ * Masked pixels are selected without branches: a mask bit b is widened to
+ * m = -b (0x0000 or 0xFFFF) and the pixel becomes (dst & ~m) | (src & m).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "led_matrix.h"
+#include "led_sprite.h"
+
+struct led_atlas {
+	int count;
+	int capacity;
+	struct led_sprite *sprites;
+};
+
+/* The part of a sprite that is visible on a surface */
+struct clip {
+	int sx, sy;	/* First visible sprite pixel */
+	int dx, dy;	/* Where it goes on the surface */
+	int w, h;	/* Visible size */
+};
+
+/*
+ * Clip a <width> x <height> sprite at <x>, <y> against <dst>.
+ *
+ * Returns 1 if any part of it is visible.
+ */
+static int clip_rect(const struct led_surface *dst, int width, int height,
+		     int x, int y, struct clip *c) {
+
+	c->sx = x < 0 ? -x : 0;
+	c->sy = y < 0 ? -y : 0;
+	c->dx = x + c->sx;
+	c->dy = y + c->sy;
+	c->w = width - c->sx;
+	c->h = height - c->sy;
+	if (c->dx + c->w > dst->width) {
+		c->w = dst->width - c->dx;
+	}
+	if (c->dy + c->h > dst->height) {
+		c->h = dst->height - c->dy;
+	}
+	return c->w > 0 && c->h > 0;
+}
+
+/* Returns a surface for the NUM_LEDS pixel frame <frame>. */
+struct led_surface led_surface_frame(uint16_t *frame) {
+
+	struct led_surface s = {frame, ROW_SIZE, NUM_LEDS / ROW_SIZE, ROW_SIZE};
+	return s;
+}
+
+/*
+ * Draw <sprite> on <dst> with its top left corner at <x>, <y>, clipped to
+ * the surface.
+ */
+void led_blit_sprite(struct led_surface *dst, const struct led_sprite *sprite,
+		     int x, int y) {
+
+	struct clip c;
+	int mask_stride = (sprite->width + 7) / 8;
+
+	if (!clip_rect(dst, sprite->width, sprite->height, x, y, &c)) {
+		return;
+	}
+	for (int r = 0; r < c.h; r++) {
+		uint16_t *d = dst->pixels + (c.dy + r) * dst->stride + c.dx;
+		const uint16_t *s = sprite->pixels == NULL ? NULL :
+			sprite->pixels + (c.sy + r) * sprite->width + c.sx;
+
+		if (sprite->mask == NULL) {
+			if (s != NULL) {
+				memcpy(d, s, c.w * sizeof(uint16_t));
+			} else {
+				for (int i = 0; i < c.w; i++) {
+					d[i] = sprite->color;
+				}
+			}
+			continue;
+		}
+
+		const uint8_t *mrow = sprite->mask + (c.sy + r) * mask_stride;
+		for (int i = 0; i < c.w; i++) {
+			int bit = c.sx + i;
+			uint16_t m = -((mrow[bit / 8] >> (bit % 8)) & 1);
+			uint16_t src = s != NULL ? s[i] : sprite->color;
+			d[i] = (d[i] & ~m) | (src & m);
+		}
+	}
+}
+
+/*
+ * Draw the character <c> from the built-in font on <dst> at <x>, <y> in
+ * the RGB565 color <fg>, with the unset pixels in the RGB565 color <bg> or
+ * left untouched if <bg> is LED_TRANSPARENT. Characters outside the font
+ * are drawn as '?'.
+ */
+void led_blit_glyph(struct led_surface *dst, char c, int x, int y,
+		    uint16_t fg, int bg) {
+
+	struct clip cl;
+	int index = (unsigned char)c - LED_FONT_FIRST;
+
+	if (index < 0 || index >= LED_FONT_GLYPHS) {
+		index = '?' - LED_FONT_FIRST;
+	}
+	if (!clip_rect(dst, LED_FONT_WIDTH, LED_FONT_HEIGHT, x, y, &cl)) {
+		return;
+	}
+	const uint8_t *glyph = led_font8x8[index];
+	for (int r = 0; r < cl.h; r++) {
+		uint16_t *d = dst->pixels + (cl.dy + r) * dst->stride + cl.dx;
+		unsigned int bits = glyph[cl.sy + r] >> cl.sx;
+		if (bg == LED_TRANSPARENT) {
+			for (int i = 0; i < cl.w; i++) {
+				uint16_t m = -((bits >> i) & 1);
+				d[i] = (d[i] & ~m) | (fg & m);
+			}
+		} else {
+			for (int i = 0; i < cl.w; i++) {
+				uint16_t m = -((bits >> i) & 1);
+				d[i] = (bg & ~m) | (fg & m);
+			}
+		}
+	}
+}
+
+/*
+ * Draw the string <text> on <dst> starting at <x>, <y>, one glyph every
+ * LED_FONT_WIDTH pixels, like led_blit_glyph(). Glyphs that fall entirely
+ * outside the surface are skipped, so scrolling a long text by moving <x>
+ * only costs for the visible glyphs.
+ *
+ * Returns the width of the whole text in pixels.
+ */
+int led_blit_text(struct led_surface *dst, const char *text, int x, int y,
+		  uint16_t fg, int bg) {
+
+	int len = strlen(text);
+
+	for (int i = 0; i < len; i++) {
+		int gx = x + i * LED_FONT_WIDTH;
+		if (gx + LED_FONT_WIDTH <= 0) {
+			continue;
+		}
+		if (gx >= dst->width) {
+			break;
+		}
+		led_blit_glyph(dst, text[i], gx, y, fg, bg);
+	}
+	return len * LED_FONT_WIDTH;
+}
+
+/*
+ * Create an empty sprite atlas.
+ *
+ * Returns a pointer to the atlas on success or NULL on error.
+ */
+struct led_atlas *led_atlas_create() {
+
+	struct led_atlas *atlas = calloc(1, sizeof(*atlas));
+	if (atlas == NULL) {
+		perror("Error on call to calloc()");
+	}
+	return atlas;
+}
+
+/* Free <atlas> and all the sprites in it. */
+void led_atlas_destroy(struct led_atlas *atlas) {
+
+	for (int i = 0; i < atlas->count; i++) {
+		free((void *)atlas->sprites[i].pixels);
+		free((void *)atlas->sprites[i].mask);
+	}
+	free(atlas->sprites);
+	free(atlas);
+}
+
+/* Returns a malloc'd copy of the <size> bytes at <src>, or NULL for NULL */
+static void *copy_data(const void *src, size_t size, int *err) {
+
+	void *copy;
+	if (src == NULL) {
+		return NULL;
+	}
+	copy = malloc(size);
+	if (copy == NULL) {
+		perror("Error on call to malloc()");
+		*err = 1;
+		return NULL;
+	}
+	return memcpy(copy, src, size);
+}
+
+/*
+ * Add a copy of a <width> x <height> sprite to <atlas>. <pixels> is
+ * width * height RGB565 pixels, or NULL to draw every pixel in <color>.
+ * <mask> is a 1-bit mask in the layout described above, or NULL for an
+ * opaque sprite.
+ *
+ * Returns the id of the new sprite on success or -1 on error.
+ */
+int led_atlas_add(struct led_atlas *atlas, int width, int height,
+		  const uint16_t *pixels, uint16_t color, const uint8_t *mask) {
+
+	struct led_sprite *sprite;
+	int err = 0;
+
+	if (width <= 0 || height <= 0) {
+		printf("Invalid sprite size %dx%d\n", width, height);
+		return -1;
+	}
+	if (atlas->count == atlas->capacity) {
+		int capacity = atlas->capacity ? 2 * atlas->capacity : 16;
+		sprite = realloc(atlas->sprites, capacity * sizeof(*sprite));
+		if (sprite == NULL) {
+			perror("Error on call to realloc()");
+			return -1;
+		}
+		atlas->sprites = sprite;
+		atlas->capacity = capacity;
+	}
+
+	sprite = &atlas->sprites[atlas->count];
+	sprite->width = width;
+	sprite->height = height;
+	sprite->color = color;
+	sprite->pixels = copy_data(pixels, (size_t)width * height *
+				   sizeof(uint16_t), &err);
+	sprite->mask = copy_data(mask, (size_t)(width + 7) / 8 * height, &err);
+	if (err) {
+		free((void *)sprite->pixels);
+		free((void *)sprite->mask);
+		return -1;
+	}
+	return atlas->count++;
+}
+
+/* Returns the sprite with id <id> in <atlas>, or NULL if there is none. */
+const struct led_sprite *led_atlas_get(const struct led_atlas *atlas, int id) {
+
+	if (id < 0 || id >= atlas->count) {
+		return NULL;
+	}
+	return &atlas->sprites[id];
+}
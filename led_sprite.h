@@ -0,0 +1,106 @@
+/*
+ * led_sprite.h
+ *
+ * This file contains declarations of functions for drawing sprites and
+ * text into RGB565 pixel buffers.
+ *
+ * A sprite is either a block of RGB565 pixels or a single color, plus an
+ * optional 1-bit transparency mask. Masks are stored row by row with
+ * (width + 7) / 8 bytes per row and bit 0 of each byte the leftmost pixel,
+ * the same layout as the glyphs of the built-in 8x8 font.
+ *
+ * The blit functions clip the sprite against the destination once, and
+ * then write whole rows without per-pixel bounds checks or branches.
+ * The usual destination is a NUM_LEDS frame that is then shown with
+ * set_leds_image(), or a canvas tile from led_canvas.h.
+ */
+
+#ifndef LED_SPRITE_H
+#define LED_SPRITE_H
+
+#include <stdint.h>
+
+/* The built-in font covers printable ASCII, starting at ' ' */
+#define LED_FONT_FIRST ' '
+#define LED_FONT_GLYPHS 95
+#define LED_FONT_WIDTH 8
+#define LED_FONT_HEIGHT 8
+
+extern const uint8_t led_font8x8[LED_FONT_GLYPHS][8];
+
+/* Pass as background color to leave unset glyph pixels untouched */
+#define LED_TRANSPARENT (-1)
+
+/* A pixel buffer to draw into; pixel (x, y) is pixels[y * stride + x] */
+struct led_surface {
+	uint16_t *pixels;
+	int width;
+	int height;
+	int stride;
+};
+
+struct led_sprite {
+	int width;
+	int height;
+	const uint16_t *pixels;	/* width * height pixels, or NULL */
+	uint16_t color;		/* Used for every pixel if pixels is NULL */
+	const uint8_t *mask;	/* 1 means drawn; NULL means opaque */
+};
+
+struct led_atlas;
+
+/* Returns a surface for the NUM_LEDS pixel frame <frame>. */
+struct led_surface led_surface_frame(uint16_t *frame);
+
+/*
+ * Draw <sprite> on <dst> with its top left corner at <x>, <y>, clipped to
+ * the surface.
+ */
+void led_blit_sprite(struct led_surface *dst, const struct led_sprite *sprite,
+		     int x, int y);
+
+/*
+ * Draw the character <c> from the built-in font on <dst> at <x>, <y> in
+ * the RGB565 color <fg>, with the unset pixels in the RGB565 color <bg> or
+ * left untouched if <bg> is LED_TRANSPARENT. Characters outside the font
+ * are drawn as '?'.
+ */
+void led_blit_glyph(struct led_surface *dst, char c, int x, int y,
+		    uint16_t fg, int bg);
+
+/*
+ * Draw the string <text> on <dst> starting at <x>, <y>, one glyph every
+ * LED_FONT_WIDTH pixels, like led_blit_glyph(). Glyphs that fall entirely
+ * outside the surface are skipped, so scrolling a long text by moving <x>
+ * only costs for the visible glyphs.
+ *
+ * Returns the width of the whole text in pixels.
+ */
+int led_blit_text(struct led_surface *dst, const char *text, int x, int y,
+		  uint16_t fg, int bg);
+
+/*
+ * Create an empty sprite atlas.
+ *
+ * Returns a pointer to the atlas on success or NULL on error.
+ */
+struct led_atlas *led_atlas_create();
+
+/* Free <atlas> and all the sprites in it. */
+void led_atlas_destroy(struct led_atlas *atlas);
+
+/*
+ * Add a copy of a <width> x <height> sprite to <atlas>. <pixels> is
+ * width * height RGB565 pixels, or NULL to draw every pixel in <color>.
+ * <mask> is a 1-bit mask in the layout described above, or NULL for an
+ * opaque sprite.
+ *
+ * Returns the id of the new sprite on success or -1 on error.
+ */
+int led_atlas_add(struct led_atlas *atlas, int width, int height,
+		  const uint16_t *pixels, uint16_t color, const uint8_t *mask);
+
+/* Returns the sprite with id <id> in <atlas>, or NULL if there is none. */
+const struct led_sprite *led_atlas_get(const struct led_atlas *atlas, int id);
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * led_timer.c
+ *
+ * This file contains functions for pacing frames at a fixed rate. See
+ * led_timer.h for an overview.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "led_timer.h"
+
+#define NS_PER_SEC 1000000000L
+
+static int64_t timespec_ns(const struct timespec *ts) {
+
+	return (int64_t)ts->tv_sec * NS_PER_SEC + ts->tv_nsec;
+}
+
+/* Add <ns> nanoseconds to <ts> */
+static void timespec_add_ns(struct timespec *ts, int64_t ns) {
+
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / NS_PER_SEC;
+	ts->tv_nsec = ns % NS_PER_SEC;
+}
+
+/*
+ * Start <timer> at <hz> frames per second, with the first deadline one
+ * period from now.
+ *
+ * Returns 0 on success and -1 if <hz> is not positive.
+ */
+int led_frame_timer_init(struct led_frame_timer *timer, int hz) {
+
+	if (hz <= 0) {
+		printf("Invalid frame rate %d\n", hz);
+		return -1;
+	}
+	timer->period_ns = NS_PER_SEC / hz;
+	clock_gettime(CLOCK_MONOTONIC, &timer->next);
+	timespec_add_ns(&timer->next, timer->period_ns);
+	timer->stats = (struct led_frame_stats){0};
+	return 0;
+}
+
+/*
+ * Sleep until the next frame deadline. If it has already passed, returns
+ * at once, and any whole periods missed since then are skipped.
+ *
+ * Returns the number of frames skipped.
+ */
+int led_frame_timer_wait(struct led_frame_timer *timer) {
+
+	struct timespec now;
+	int64_t lateness;
+	int skipped = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_ns(&now) < timespec_ns(&timer->next)) {
+		/* The deadline is absolute, so a signal just means retry */
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &timer->next, NULL) == EINTR) {
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} else {
+		timer->stats.late++;
+	}
+
+	lateness = timespec_ns(&now) - timespec_ns(&timer->next);
+	if (lateness >= timer->period_ns) {
+		skipped = lateness / timer->period_ns;
+		timespec_add_ns(&timer->next, (int64_t)skipped *
+				timer->period_ns);
+		lateness -= (int64_t)skipped * timer->period_ns;
+		timer->stats.skipped += skipped;
+	}
+	if (lateness > 0) {
+		timer->stats.total_lateness_ns += lateness;
+		if (lateness > timer->stats.max_lateness_ns) {
+			timer->stats.max_lateness_ns = lateness;
+		}
+	}
+	timer->stats.frames++;
+	timespec_add_ns(&timer->next, timer->period_ns);
+	return skipped;
+}
+
+/*
+ * Call <callback>(<arg>, <frame>) once per frame, where <frame> counts
+ * deadlines including skipped ones, until it returns nonzero.
+ *
+ * Returns the value returned by <callback>.
+ */
+int led_frame_timer_run(struct led_frame_timer *timer,
+			int (*callback)(void *arg, uint64_t frame), void *arg) {
+
+	uint64_t frame = 0;
+	int ret;
+
+	for (;;) {
+		frame += led_frame_timer_wait(timer);
+		ret = callback(arg, frame++);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+}
+
+/* Print the statistics of <timer> on one line to stdout. */
+void led_frame_timer_print_stats(const struct led_frame_timer *timer) {
+
+	const struct led_frame_stats *s = &timer->stats;
+	printf("frames %llu, late %llu, skipped %llu, mean lateness %.1f us, "
+	       "max lateness %.1f us\n", (unsigned long long)s->frames,
+	       (unsigned long long)s->late, (unsigned long long)s->skipped,
+	       s->frames ? s->total_lateness_ns / 1e3 / s->frames : 0.0,
+	       s->max_lateness_ns / 1e3);
+}
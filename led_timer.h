@@ -0,0 +1,64 @@
+/*
+ * led_timer.h
+ *
+ * This file contains declarations of functions for pacing frames at a
+ * fixed rate.
+ *
+ * Frame deadlines are kept as absolute CLOCK_MONOTONIC times, one period
+ * apart, and the timer sleeps with clock_nanosleep(TIMER_ABSTIME) until
+ * the next one. Rounding errors and time spent drawing therefore never
+ * accumulate into drift. When a frame is so late that whole deadlines
+ * have passed, those frames are skipped instead of being delivered in a
+ * burst, and the timer keeps statistics on late and skipped frames.
+ */
+
+#ifndef LED_TIMER_H
+#define LED_TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+
+struct led_frame_stats {
+	uint64_t frames;	/* Frames delivered */
+	uint64_t late;		/* Deadline already passed when waiting */
+	uint64_t skipped;	/* Deadlines that passed without a frame */
+	int64_t max_lateness_ns;	/* Worst delivery after a deadline */
+	int64_t total_lateness_ns;	/* Sum, for the mean */
+};
+
+/* The fields are private to led_timer.c, except <stats> can be read */
+struct led_frame_timer {
+	long period_ns;
+	struct timespec next;	/* Next deadline */
+	struct led_frame_stats stats;
+};
+
+/*
+ * Start <timer> at <hz> frames per second, with the first deadline one
+ * period from now.
+ *
+ * Returns 0 on success and -1 if <hz> is not positive.
+ */
+int led_frame_timer_init(struct led_frame_timer *timer, int hz);
+
+/*
+ * Sleep until the next frame deadline. If it has already passed, returns
+ * at once, and any whole periods missed since then are skipped.
+ *
+ * Returns the number of frames skipped.
+ */
+int led_frame_timer_wait(struct led_frame_timer *timer);
+
+/*
+ * Call <callback>(<arg>, <frame>) once per frame, where <frame> counts
+ * deadlines including skipped ones, until it returns nonzero.
+ *
+ * Returns the value returned by <callback>.
+ */
+int led_frame_timer_run(struct led_frame_timer *timer,
+			int (*callback)(void *arg, uint64_t frame), void *arg);
+
+/* Print the statistics of <timer> on one line to stdout. */
+void led_frame_timer_print_stats(const struct led_frame_timer *timer);
+
+#endif
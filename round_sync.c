@@ -0,0 +1,157 @@
+/*
+ * round_sync.c
+ *
+ * This file contains functions for starting and finishing rounds of a
+ * scheduling experiment without busy-waiting. See round_sync.h for an
+ * overview.
+ *
+ * The barrier has to be initialized for the number of threads that will
+ * wait on it, so it is set up again at the start of every round, when no
+ * child of the previous round can still be using it.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "round_sync.h"
+
+struct round_sync {
+	pthread_barrier_t barrier;
+	int barrier_ready;	/* The barrier is initialized */
+	int use_barrier;	/* round_sync_start() waits on it this round */
+	int efd;		/* Completion eventfd */
+};
+
+/*
+ * Create a round synchronizer in an anonymous MAP_SHARED mapping.
+ *
+ * Returns a pointer to it on success or NULL on error.
+ */
+struct round_sync *round_sync_create() {
+
+	struct round_sync *sync;
+
+	sync = mmap(NULL, sizeof(*sync), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sync == MAP_FAILED) {
+		perror("Error on call to mmap()");
+		return NULL;
+	}
+	sync->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (sync->efd == -1) {
+		perror("Error on call to eventfd()");
+		munmap(sync, sizeof(*sync));
+		return NULL;
+	}
+	return sync;
+}
+
+/* Close and unmap a round synchronizer created with round_sync_create(). */
+void round_sync_destroy(struct round_sync *sync) {
+
+	if (sync->barrier_ready) {
+		pthread_barrier_destroy(&sync->barrier);
+	}
+	close(sync->efd);
+	munmap(sync, sizeof(*sync));
+}
+
+/*
+ * Prepare a round of <num_children> children. With <barrier> nonzero, the
+ * children and the parent must all call round_sync_start() before any of
+ * them continues; otherwise round_sync_start() returns at once.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int round_sync_begin(struct round_sync *sync, int num_children, int barrier) {
+
+	pthread_barrierattr_t attr;
+	uint64_t stale;
+	int ret;
+
+	/* Drop completions left over from an interrupted round */
+	while (read(sync->efd, &stale, sizeof(stale)) > 0) {
+	}
+
+	sync->use_barrier = barrier;
+	if (!barrier) {
+		return 0;
+	}
+	if (sync->barrier_ready) {
+		pthread_barrier_destroy(&sync->barrier);
+		sync->barrier_ready = 0;
+	}
+	pthread_barrierattr_init(&attr);
+	pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	ret = pthread_barrier_init(&sync->barrier, &attr, num_children + 1);
+	pthread_barrierattr_destroy(&attr);
+	if (ret != 0) {
+		errno = ret;
+		perror("Error on call to pthread_barrier_init()");
+		return -1;
+	}
+	sync->barrier_ready = 1;
+	return 0;
+}
+
+/*
+ * Forget the barrier of a round whose children were killed while waiting
+ * on it. It is not destroyed, since pthread_barrier_destroy() may wait for
+ * them to leave, and the next round_sync_begin() initializes it again.
+ */
+void round_sync_abandon(struct round_sync *sync) {
+
+	sync->barrier_ready = 0;
+	sync->use_barrier = 0;
+}
+
+/* Wait until every child of the round and the parent have arrived. */
+void round_sync_start(struct round_sync *sync) {
+
+	if (sync->use_barrier) {
+		pthread_barrier_wait(&sync->barrier);
+	}
+}
+
+/* Report that the calling child has finished its work. */
+void round_sync_done(struct round_sync *sync) {
+
+	uint64_t one = 1;
+
+	if (write(sync->efd, &one, sizeof(one)) == -1) {
+		perror("Error on call to write()");
+	}
+}
+
+/*
+ * Sleep until at least one child reports that it is done, or for at most
+ * <timeout_ms> milliseconds.
+ *
+ * Returns the number of children that finished, 0 on timeout or -1 on
+ * error.
+ */
+int round_sync_wait(struct round_sync *sync, int timeout_ms) {
+
+	struct pollfd pfd = {sync->efd, POLLIN, 0};
+	uint64_t done;
+	int n;
+
+	n = poll(&pfd, 1, timeout_ms);
+	if (n == -1) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		perror("Error on call to poll()");
+		return -1;
+	}
+	if (n == 0 || read(sync->efd, &done, sizeof(done)) != sizeof(done)) {
+		return 0;
+	}
+	return done;
+}
@@ -0,0 +1,64 @@
+/*
+ * round_sync.h
+ *
+ * This file contains declarations of functions for starting and finishing
+ * a round of a scheduling experiment without busy-waiting.
+ *
+ * The start of a round is a process-shared pthread barrier, which glibc
+ * implements with futexes, so all children of a round and the parent are
+ * released at the same moment after the fork()s, and no child gets a head
+ * start from being forked first. Completion is an eventfd that every
+ * child adds one to when it is done, so the parent sleeps in poll() until
+ * a child finishes or it is time to redraw the LED matrix.
+ *
+ * A round_sync must be created before fork() to be shared with the
+ * children. Programs using these functions must be linked with -pthread.
+ */
+
+#ifndef ROUND_SYNC_H
+#define ROUND_SYNC_H
+
+struct round_sync;
+
+/*
+ * Create a round synchronizer in an anonymous MAP_SHARED mapping.
+ *
+ * Returns a pointer to it on success or NULL on error.
+ */
+struct round_sync *round_sync_create();
+
+/* Close and unmap a round synchronizer created with round_sync_create(). */
+void round_sync_destroy(struct round_sync *sync);
+
+/*
+ * Prepare a round of <num_children> children. With <barrier> nonzero, the
+ * children and the parent must all call round_sync_start() before any of
+ * them continues; otherwise round_sync_start() returns at once.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int round_sync_begin(struct round_sync *sync, int num_children, int barrier);
+
+/*
+ * Forget the barrier of a round whose children were killed while waiting
+ * on it. It is not destroyed, since pthread_barrier_destroy() may wait for
+ * them to leave, and the next round_sync_begin() initializes it again.
+ */
+void round_sync_abandon(struct round_sync *sync);
+
+/* Wait until every child of the round and the parent have arrived. */
+void round_sync_start(struct round_sync *sync);
+
+/* Report that the calling child has finished its work. */
+void round_sync_done(struct round_sync *sync);
+
+/*
+ * Sleep until at least one child reports that it is done, or for at most
+ * <timeout_ms> milliseconds.
+ *
+ * Returns the number of children that finished, 0 on timeout or -1 on
+ * error.
+ */
+int round_sync_wait(struct round_sync *sync, int timeout_ms);
+
+#endif
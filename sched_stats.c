@@ -0,0 +1,63 @@
+/*
+ * sched_stats.c
+ *
+ * This file contains functions for summarizing repeated measurements. See
+ * sched_stats.h for an overview.
+ */
+
+#include <math.h>
+
+#include "sched_stats.h"
+
+/*
+ * Two-sided 95% critical values of Student's t distribution for 1 to 30
+ * degrees of freedom. Beyond that the normal value 1.96 is close enough.
+ */
+static const double t95[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+#define NUM_T95 (sizeof(t95) / sizeof(t95[0]))
+
+/* Reset <stat> to no samples. */
+void sched_stat_init(struct sched_stat *stat) {
+
+	stat->n = 0;
+	stat->mean = 0;
+	stat->m2 = 0;
+}
+
+/* Add the sample <x> to <stat>. */
+void sched_stat_add(struct sched_stat *stat, double x) {
+
+	double delta = x - stat->mean;
+	stat->n++;
+	stat->mean += delta / stat->n;
+	stat->m2 += delta * (x - stat->mean);
+}
+
+/* Returns the sample standard deviation of <stat>, 0 with under 2 samples. */
+double sched_stat_stddev(const struct sched_stat *stat) {
+
+	if (stat->n < 2) {
+		return 0;
+	}
+	return sqrt(stat->m2 / (stat->n - 1));
+}
+
+/*
+ * Returns the half-width of the 95% confidence interval for the mean of
+ * <stat>, using Student's t distribution, or 0 with under 2 samples.
+ */
+double sched_stat_ci95(const struct sched_stat *stat) {
+
+	long df = stat->n - 1;
+	double t;
+
+	if (stat->n < 2) {
+		return 0;
+	}
+	t = df <= (long)NUM_T95 ? t95[df - 1] : 1.96;
+	return t * sched_stat_stddev(stat) / sqrt(stat->n);
+}
@@ -0,0 +1,37 @@
+/*
+ * sched_stats.h
+ *
+ * This file contains declarations of functions for summarizing repeated
+ * measurements: mean, standard deviation and a 95% confidence interval
+ * for the mean.
+ *
+ * Samples are accumulated one at a time with Welford's method, so no
+ * samples need to be stored and the variance stays accurate when the
+ * spread is small compared to the mean.
+ */
+
+#ifndef SCHED_STATS_H
+#define SCHED_STATS_H
+
+struct sched_stat {
+	long n;		/* Samples added */
+	double mean;
+	double m2;	/* Sum of squared differences from the mean */
+};
+
+/* Reset <stat> to no samples. */
+void sched_stat_init(struct sched_stat *stat);
+
+/* Add the sample <x> to <stat>. */
+void sched_stat_add(struct sched_stat *stat, double x);
+
+/* Returns the sample standard deviation of <stat>, 0 with under 2 samples. */
+double sched_stat_stddev(const struct sched_stat *stat);
+
+/*
+ * Returns the half-width of the 95% confidence interval for the mean of
+ * <stat>, using Student's t distribution, or 0 with under 2 samples.
+ */
+double sched_stat_ci95(const struct sched_stat *stat);
+
+#endif
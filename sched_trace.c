@@ -0,0 +1,137 @@
+/*
+ * sched_trace.c
+ *
+ * This file contains functions for recording scheduling measurements from
+ * many processes or threads with little overhead. See sched_trace.h for
+ * an overview.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "sched_trace.h"
+
+struct sched_trace {
+	size_t capacity;
+	size_t mapped_size;
+	atomic_int round;
+	atomic_size_t next;	/* Total samples claimed since the last dump */
+	struct sched_sample samples[];
+};
+
+static int64_t clock_ns(clockid_t clock) {
+
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Create a trace with room for <capacity> samples. When more samples than
+ * that are recorded between two dumps, the oldest ones are overwritten.
+ *
+ * Returns a pointer to the trace on success or NULL on error.
+ */
+struct sched_trace *sched_trace_create(size_t capacity) {
+
+	struct sched_trace *trace;
+	size_t size = sizeof(*trace) + capacity * sizeof(struct sched_sample);
+
+	trace = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (trace == MAP_FAILED) {
+		perror("Error on call to mmap()");
+		return NULL;
+	}
+	trace->capacity = capacity;
+	trace->mapped_size = size;
+	return trace;
+}
+
+/*
+ * Unmap a trace created with sched_trace_create().
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int sched_trace_destroy(struct sched_trace *trace) {
+
+	if (munmap(trace, trace->mapped_size) == -1) {
+		perror("Error on call to munmap()");
+		return -1;
+	}
+	return 0;
+}
+
+/* Set the round number stored in subsequently recorded samples. */
+void sched_trace_set_round(struct sched_trace *trace, int round) {
+
+	atomic_store(&trace->round, round);
+}
+
+/*
+ * Record a sample for step <step> of child <child>, measured for the
+ * calling thread.
+ */
+void sched_trace_record(struct sched_trace *trace, int child, int step) {
+
+	struct rusage usage;
+	size_t slot = atomic_fetch_add_explicit(&trace->next, 1,
+						memory_order_relaxed);
+	struct sched_sample *s = &trace->samples[slot % trace->capacity];
+
+	s->mono_ns = clock_ns(CLOCK_MONOTONIC);
+	s->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	getrusage(RUSAGE_THREAD, &usage);
+	s->nvcsw = usage.ru_nvcsw;
+	s->nivcsw = usage.ru_nivcsw;
+	s->cpu = sched_getcpu();
+	s->pid = getpid();
+	s->tid = syscall(SYS_gettid);
+	s->nice = getpriority(PRIO_PROCESS, s->tid);
+	s->round = atomic_load_explicit(&trace->round, memory_order_relaxed);
+	s->child = child;
+	s->step = step;
+}
+
+/*
+ * Write all samples recorded since the last dump to <out> as CSV, with a
+ * header line if <header> is nonzero, and empty the trace. No samples
+ * should be recorded while this runs.
+ *
+ * Returns the number of samples written, or -1 on error.
+ */
+int sched_trace_dump_csv(struct sched_trace *trace, FILE *out, int header) {
+
+	size_t count = atomic_load(&trace->next);
+	size_t first = 0;
+
+	if (count > trace->capacity) {
+		first = count - trace->capacity;
+	}
+	if (header) {
+		fprintf(out, "round,child,step,pid,tid,cpu,nice,mono_ns,"
+			"cpu_ns,nvcsw,nivcsw\n");
+	}
+	for (size_t i = first; i < count; i++) {
+		struct sched_sample *s = &trace->samples[i % trace->capacity];
+		fprintf(out, "%d,%d,%d,%d,%d,%d,%d,%lld,%lld,%ld,%ld\n",
+			s->round, s->child, s->step, s->pid, s->tid, s->cpu,
+			s->nice, (long long)s->mono_ns, (long long)s->cpu_ns,
+			s->nvcsw, s->nivcsw);
+	}
+	atomic_store(&trace->next, 0);
+	if (fflush(out) == EOF) {
+		perror("Error on call to fflush()");
+		return -1;
+	}
+	return count - first;
+}
@@ -0,0 +1,70 @@
+/*
+ * sched_trace.h
+ *
+ * This file contains declarations of functions for recording scheduling
+ * measurements from many processes or threads with little overhead.
+ *
+ * A trace is a preallocated ring of samples in an anonymous MAP_SHARED
+ * mapping, so it must be created before fork() to be shared with the
+ * children. Recording a sample claims a slot with a single atomic add and
+ * never allocates, locks or does I/O. The samples are written out as CSV
+ * with sched_trace_dump_csv(), typically by the parent between rounds.
+ */
+
+#ifndef SCHED_TRACE_H
+#define SCHED_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+struct sched_sample {
+	int round;
+	int child;
+	int step;
+	int pid;
+	int tid;
+	int cpu;		/* CPU the caller was running on */
+	int nice;
+	int64_t mono_ns;	/* CLOCK_MONOTONIC */
+	int64_t cpu_ns;		/* CLOCK_THREAD_CPUTIME_ID */
+	long nvcsw;		/* Voluntary context switches */
+	long nivcsw;		/* Involuntary context switches */
+};
+
+struct sched_trace;
+
+/*
+ * Create a trace with room for <capacity> samples. When more samples than
+ * that are recorded between two dumps, the oldest ones are overwritten.
+ *
+ * Returns a pointer to the trace on success or NULL on error.
+ */
+struct sched_trace *sched_trace_create(size_t capacity);
+
+/*
+ * Unmap a trace created with sched_trace_create().
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int sched_trace_destroy(struct sched_trace *trace);
+
+/* Set the round number stored in subsequently recorded samples. */
+void sched_trace_set_round(struct sched_trace *trace, int round);
+
+/*
+ * Record a sample for step <step> of child <child>, measured for the
+ * calling thread.
+ */
+void sched_trace_record(struct sched_trace *trace, int child, int step);
+
+/*
+ * Write all samples recorded since the last dump to <out> as CSV, with a
+ * header line if <header> is nonzero, and empty the trace. No samples
+ * should be recorded while this runs.
+ *
+ * Returns the number of samples written, or -1 on error.
+ */
+int sched_trace_dump_csv(struct sched_trace *trace, FILE *out, int header);
+
+#endif
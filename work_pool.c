@@ -0,0 +1,264 @@
+/*
+ * work_pool.c
+ *
+ * This file contains functions for a persistent pool of worker threads
+ * that share work by work stealing. See work_pool.h for an overview.
+ *
+ * Each deque is a small ring buffer protected by its own mutex, so the
+ * owner and thieves only contend when they touch the same deque. A single
+ * pool-wide mutex and condition variables are used only to put idle
+ * workers to sleep and to wake up work_pool_wait().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "work_pool.h"
+
+struct work_item {
+	void (*fn)(void *arg);
+	void *arg;
+};
+
+struct work_deque {
+	pthread_mutex_t lock;
+	struct work_item items[WORK_DEQUE_SIZE];
+	unsigned int head;	/* Thieves take from here */
+	unsigned int tail;	/* Owner pushes and pops here */
+};
+
+struct worker {
+	struct work_pool *pool;
+	int id;
+	pthread_t thread;
+};
+
+struct work_pool {
+	int num_workers;
+	void (*worker_init)(int worker);
+	struct work_deque *deques;
+	struct worker *workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_available;
+	pthread_cond_t all_done;
+	int queued;		/* Items in the deques */
+	int pending;		/* Items queued or running */
+	int stopping;
+};
+
+/* Pop from the back of <d>. Returns 1 if an item was taken. */
+static int deque_pop(struct work_deque *d, struct work_item *item) {
+
+	int found = 0;
+	pthread_mutex_lock(&d->lock);
+	if (d->tail != d->head) {
+		d->tail--;
+		*item = d->items[d->tail % WORK_DEQUE_SIZE];
+		found = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return found;
+}
+
+/* Steal from the front of <d>. Returns 1 if an item was taken. */
+static int deque_steal(struct work_deque *d, struct work_item *item) {
+
+	int found = 0;
+	pthread_mutex_lock(&d->lock);
+	if (d->tail != d->head) {
+		*item = d->items[d->head % WORK_DEQUE_SIZE];
+		d->head++;
+		found = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return found;
+}
+
+/*
+ * Find work for worker <id>, first in its own deque and then in the
+ * others, starting with its neighbour. Returns 1 if an item was taken.
+ */
+static int find_work(struct work_pool *pool, int id, struct work_item *item) {
+
+	if (deque_pop(&pool->deques[id], item)) {
+		return 1;
+	}
+	for (int i = 1; i < pool->num_workers; i++) {
+		int victim = (id + i) % pool->num_workers;
+		if (deque_steal(&pool->deques[victim], item)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void *worker_main(void *arg) {
+
+	struct worker *self = arg;
+	struct work_pool *pool = self->pool;
+	struct work_item item;
+
+	if (pool->worker_init != NULL) {
+		pool->worker_init(self->id);
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->queued == 0 && !pool->stopping) {
+			pthread_cond_wait(&pool->work_available, &pool->lock);
+		}
+		if (pool->stopping) {
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		if (!find_work(pool, self->id, &item)) {
+			continue;
+		}
+		pthread_mutex_lock(&pool->lock);
+		pool->queued--;
+		pthread_mutex_unlock(&pool->lock);
+
+		item.fn(item.arg);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->pending == 0) {
+			pthread_cond_broadcast(&pool->all_done);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/*
+ * Create a pool of <num_workers> threads. If <worker_init> is not NULL,
+ * each worker thread calls it with its worker number (0 to
+ * num_workers - 1) before taking any work, e.g. to set its priority.
+ *
+ * Returns a pointer to the pool on success or NULL on error.
+ */
+struct work_pool *work_pool_create(int num_workers,
+				   void (*worker_init)(int worker)) {
+
+	struct work_pool *pool;
+
+	if (num_workers <= 0) {
+		printf("Invalid number of workers %d\n", num_workers);
+		return NULL;
+	}
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		perror("Error on call to calloc()");
+		return NULL;
+	}
+	pool->deques = calloc(num_workers, sizeof(*pool->deques));
+	pool->workers = calloc(num_workers, sizeof(*pool->workers));
+	if (pool->deques == NULL || pool->workers == NULL) {
+		perror("Error on call to calloc()");
+		free(pool->deques);
+		free(pool->workers);
+		free(pool);
+		return NULL;
+	}
+	pool->num_workers = num_workers;
+	pool->worker_init = worker_init;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_available, NULL);
+	pthread_cond_init(&pool->all_done, NULL);
+	for (int i = 0; i < num_workers; i++) {
+		pthread_mutex_init(&pool->deques[i].lock, NULL);
+	}
+
+	for (int i = 0; i < num_workers; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+		int err = pthread_create(&pool->workers[i].thread, NULL,
+					 worker_main, &pool->workers[i]);
+		if (err != 0) {
+			fprintf(stderr, "Error on call to pthread_create(): "
+				"%s\n", strerror(err));
+			pool->num_workers = i;
+			work_pool_destroy(pool);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+/*
+ * Queue a call to <fn>(<arg>) on the deque of worker <worker>. It may
+ * still run on another worker if that one runs out of work.
+ *
+ * Returns 0 on success and -1 if the deque is full.
+ */
+int work_pool_submit(struct work_pool *pool, int worker,
+		     void (*fn)(void *arg), void *arg) {
+
+	struct work_deque *d = &pool->deques[worker % pool->num_workers];
+
+	/*
+	 * Hold pool->lock while the item is pushed, so that the counters are
+	 * updated before any worker can take it and decrement them.
+	 */
+	pthread_mutex_lock(&pool->lock);
+	pthread_mutex_lock(&d->lock);
+	if (d->tail - d->head == WORK_DEQUE_SIZE) {
+		pthread_mutex_unlock(&d->lock);
+		pthread_mutex_unlock(&pool->lock);
+		return -1;
+	}
+	d->items[d->tail % WORK_DEQUE_SIZE].fn = fn;
+	d->items[d->tail % WORK_DEQUE_SIZE].arg = arg;
+	d->tail++;
+	pthread_mutex_unlock(&d->lock);
+
+	pool->queued++;
+	pool->pending++;
+	pthread_cond_broadcast(&pool->work_available);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+/* Returns the number of submitted items that have not yet finished. */
+int work_pool_pending(struct work_pool *pool) {
+
+	pthread_mutex_lock(&pool->lock);
+	int pending = pool->pending;
+	pthread_mutex_unlock(&pool->lock);
+	return pending;
+}
+
+/* Block until all submitted items have finished. */
+void work_pool_wait(struct work_pool *pool) {
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0) {
+		pthread_cond_wait(&pool->all_done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Stop and join all worker threads and free the pool. Items that have not
+ * started yet are discarded.
+ */
+void work_pool_destroy(struct work_pool *pool) {
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->work_available);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->num_workers; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_available);
+	pthread_cond_destroy(&pool->all_done);
+	free(pool->deques);
+	free(pool->workers);
+	free(pool);
+}
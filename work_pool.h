@@ -0,0 +1,54 @@
+/*
+ * work_pool.h
+ *
+ * This file contains declarations of functions for a persistent pool of
+ * worker threads that share work by work stealing.
+ *
+ * Every worker has its own deque of work items. A worker takes items from
+ * the back of its own deque, and when that is empty it steals from the
+ * front of the other workers' deques, so items submitted to a busy worker
+ * are picked up by idle ones. Workers sleep while there is no work.
+ *
+ * Programs using these functions must be linked with -pthread.
+ */
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+/* Maximum number of queued items per worker */
+#define WORK_DEQUE_SIZE 64
+
+struct work_pool;
+
+/*
+ * Create a pool of <num_workers> threads. If <worker_init> is not NULL,
+ * each worker thread calls it with its worker number (0 to
+ * num_workers - 1) before taking any work, e.g. to set its priority.
+ *
+ * Returns a pointer to the pool on success or NULL on error.
+ */
+struct work_pool *work_pool_create(int num_workers,
+				   void (*worker_init)(int worker));
+
+/*
+ * Queue a call to <fn>(<arg>) on the deque of worker <worker>. It may
+ * still run on another worker if that one runs out of work.
+ *
+ * Returns 0 on success and -1 if the deque is full.
+ */
+int work_pool_submit(struct work_pool *pool, int worker,
+		     void (*fn)(void *arg), void *arg);
+
+/* Returns the number of submitted items that have not yet finished. */
+int work_pool_pending(struct work_pool *pool);
+
+/* Block until all submitted items have finished. */
+void work_pool_wait(struct work_pool *pool);
+
+/*
+ * Stop and join all worker threads and free the pool. Items that have not
+ * started yet are discarded.
+ */
+void work_pool_destroy(struct work_pool *pool);
+
+#endif